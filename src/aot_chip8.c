@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <string.h>
+#include "chip8_aot.h"
+
+//translates roms ahead of time into the cache used by test_chip8 -aot
+//usage: aot_chip8 [-c] rom.ch8...
+//-c prints the generated C code instead of compiling it
+int main(int argc, char *argv[]) {
+  Chip8 chip8;
+  char path[AOT_PATH_SIZE];
+  int print_code = 0;
+  int i, size;
+
+  if (argc < 2) {
+    printf("usage: %s [-c] rom.ch8...\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      print_code = 1;
+      continue;
+    }
+
+    memset(chip8.ram, 0, RAM_SIZE);
+    size = Chip8_loadGame(&chip8, argv[i]);
+    if (size == 0)
+      continue;
+
+    if (print_code) {
+      Chip8_aotTranslate(stdout, chip8.ram, size);
+      continue;
+    }
+
+    if (!Chip8_aotBuild(chip8.ram, size))
+      return 1;
+    Chip8_aotPath(chip8.ram, size, path, "so");
+    printf("%s: %s\n", argv[i], path);
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+//runs games on headless machines as fast as possible, for batch jobs and pgo training
+//usage: batch_chip8 [-frames N] [-metrics file] [-json] rom.ch8...
+//prints one line per game with the frames run, the fault that stopped it, if any,
+//and a hash of the final display to compare runs. -metrics writes the metrics of all the
+//runs to a file at the end
+
+#define BATCH_FRAMES 3600 //one minute of emulated time
+
+//FNV-1a hash of the display
+unsigned long long batch_displayHash(Chip8 *chip8) {
+  unsigned long long hash = 0xCBF29CE484222325ULL;
+  int i;
+
+  for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+    hash ^= chip8->display[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+int main(int argc, char *argv[]) {
+  Chip8 chip8;
+  Chip8Metrics metrics;
+  char *metrics_path = NULL;
+  int metrics_format = METRICS_PROMETHEUS;
+  int frames = BATCH_FRAMES;
+  int faults = 0;
+  int i, frame;
+
+  if (argc < 2) {
+    printf("usage: %s [-frames N] [-metrics file] [-json] rom.ch8...\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+      metrics_path = argv[++i];
+      Chip8_metricsInit(&metrics);
+      continue;
+    }
+    if (strcmp(argv[i], "-json") == 0) {
+      metrics_format = METRICS_JSON;
+      continue;
+    }
+
+    Chip8_initHeadless(&chip8);
+    if (metrics_path != NULL)
+      chip8.metrics = &metrics;
+    if (Chip8_loadGame(&chip8, argv[i]) == 0)
+      continue;
+
+    for (frame = 0; frame < frames && chip8.fault == FAULT_NONE; frame++)
+      Chip8_runFrame(&chip8);
+
+    printf("%s: %d frames, fault: %s, display: %016llx\n", argv[i], frame,
+           Chip8_faultNames[chip8.fault], batch_displayHash(&chip8));
+    faults += chip8.fault != FAULT_NONE;
+  }
+
+  if (metrics_path != NULL && !Chip8_metricsWriteFile(&metrics, metrics_format, metrics_path))
+    printf("Couldn't write the metrics: %s\n", metrics_path);
+  return faults > 0;
+}
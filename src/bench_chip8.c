@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+
+//measures interpreter speed on headless machines
+//every instruction is executed, wait loops aren't skipped
+//usage: bench_chip8 [-cycles N] rom.ch8...
+
+#define BENCH_CYCLES 10000000
+
+//current time in seconds
+double bench_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+  Chip8 chip8;
+  long cycles = BENCH_CYCLES;
+  long total_cycles = 0;
+  double total_time = 0;
+  double start, elapsed;
+  long cycle;
+  int i;
+
+  if (argc < 2) {
+    printf("usage: %s [-cycles N] rom.ch8...\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-cycles") == 0 && i + 1 < argc) {
+      cycles = atol(argv[++i]);
+      continue;
+    }
+
+    Chip8_initHeadless(&chip8);
+    if (Chip8_loadGame(&chip8, argv[i]) == 0)
+      continue;
+
+    start = bench_now();
+    for (cycle = 0; cycle < cycles && chip8.fault == FAULT_NONE; cycle++) {
+      Chip8_step(&chip8);
+      if (cycle % CYCLES_PER_FRAME == CYCLES_PER_FRAME - 1)
+        Chip8_timerTick(&chip8);
+    }
+    elapsed = bench_now() - start;
+
+    printf("%s: %ld instructions in %.3f s, %.1f MIPS\n", argv[i], cycle, elapsed, cycle / elapsed / 1000000);
+    total_cycles += cycle;
+    total_time += elapsed;
+  }
+
+  if (total_time > 0)
+    printf("total: %ld instructions in %.3f s, %.1f MIPS\n", total_cycles, total_time,
+           total_cycles / total_time / 1000000);
+  return 0;
+}
@@ -1,57 +1,19 @@
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
-#define SCREEN_SCALE_FACTOR 10
-#define RAM_SIZE 4096
-#define RAM_PROGRAM_START 512
-#define MAX_GAME_SIZE 4096-512
-#define CPU_CLOCK_DELAY 0.001 //500Hz (0.002 s) should be enough for most basic games
-#define TIMER_DELAY 0.0166667 //60Hz (0.0166667 s) for timers
-#define SHIFT_INSTRUCTION 1 //if 1, 8XY6 and 8XYE just shift vx. if 0 first sets vx to vy then shifts
-#define JUMP_INSTRUCTION 1 //if 1, BNNN uses v0, else it becomes BXNN, using vx
-#define STORE_INSTRUCTION 1 //if 1, does not increment index while storing/loading registers
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 #include <SDL2/SDL.h>
-
-typedef struct { 
-  unsigned char ram[RAM_SIZE];
-  unsigned char display [SCREEN_WIDTH * SCREEN_HEIGHT];
-  unsigned char V[16]; //all purpose registers
-  unsigned short I; //memory address pointer
-  unsigned short PC; //program address
-  unsigned short opcode; //current opcode
-  unsigned char delay_timer; //interpreter runs while > 0
-  unsigned char sound_timer; //beeps while > 0
-  unsigned short subroutine_stack [16]; //contains information to return from subroutines
-  unsigned short SP; //points to top of subroutine stack
-  unsigned char key; //current key being pressed on keypad
-  unsigned char was_key_pressed; //variable that stores if there is currently a key being pressed
-  float cycleCounter; //stores time elapsed in s since last 60Hz timing
-} Chip8;
+#include "chip8.h"
 
 //SDL global variables
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
 SDL_Texture *texture = NULL;
 
-//initializes chip8 variables and SDL screen
-//input: chip8 struct
-void Chip8_init(Chip8 *chip8){
-  int i;
-
-  //starts random number
-  srand(time(NULL));
-
-  //clearing RAM
-  for (i = 0; i < 4096; i++)
-    chip8->ram[i] = 0;
-  
-  //loading fontset on RAM. ADDR 0x00 to 0x50
-  unsigned char fontset[80] =
-  { 
+//power on state, copied whole by Chip8_reset: fonts in ram, PC at the program, no key
+static const Chip8 Chip8_bootImage = {
+  .ram = {
+    //fontset, ADDR FONT_START 0x00 to 0x50
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -67,179 +29,326 @@ void Chip8_init(Chip8 *chip8){
     0xF0, 0x80, 0x80, 0x80, 0xF0, // C
     0xE0, 0x90, 0x90, 0x90, 0xE0, // D
     0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-  };
-  for (i = 0; i < 80; i++)
-    chip8->ram[i] = fontset[i];
-
-  //clearing subroutine stack
-  for (i = 0; i < 16; i++) {
-    chip8->V[i] = 0;
-    chip8->subroutine_stack[i] = 0;
-  }
-  
-  //clearing display
-  for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
-    chip8->display[i] = 0;
+    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+
+    //SuperChip big fontset, ADDR FONT_BIG_START 0x50 to 0xB4
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C  // 9
+  },
+  .PC = RAM_PROGRAM_START,
+  .key = 16,
+  .fault = FAULT_NONE,
+  .metrics = NULL
+};
+
+//0 until the SDL screen is first needed, then 1 if it was created or -1 if it failed
+static int video = 0;
+
+//resets chip8 variables to their power on state
+//input: chip8 struct
+void Chip8_reset(Chip8 *chip8){
+  //starts random number
+  srand(time(NULL));
+
+  //everything else is zero, so the whole state comes from the boot image in one copy
+  *chip8 = Chip8_bootImage;
+}
 
-  //setting PC to start of program
-  chip8->PC = RAM_PROGRAM_START;
+//initializes a chip8 that runs without SDL screen or keyboard, such as server sessions
+//input: chip8 struct
+void Chip8_initHeadless(Chip8 *chip8){
+  Chip8_reset(chip8);
+  chip8->headless = 1;
+}
 
-  //clearing variables
-  chip8->I = 0;
-  chip8->SP = 0;
-  chip8->opcode = 0;
-  chip8->key = 16;
-  chip8->was_key_pressed = 0;
-  chip8->delay_timer = 0;
-  chip8->sound_timer = 0;
-  chip8->cycleCounter = 0;
+//initializes chip8 variables for the SDL screen
+//SDL itself starts with the first frame that isn't blank, or a FX0A key wait, so loading
+//the game and the first instructions don't wait for it
+//input: chip8 struct
+void Chip8_init(Chip8 *chip8){
+  Chip8_reset(chip8);
+}
+
+//initializes SDL and the screen the first time they are needed
+//output: 1 if the screen can be used
+int Chip8_initVideo(void) {
+  if (video != 0)
+    return video > 0;
+  video = -1;
 
   //initializing SDL
   if(SDL_Init(SDL_INIT_VIDEO) < 0) {
       printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
-      return;
+      return 0;
   }
   //initializing SDL global variables
   window = SDL_CreateWindow("CHIP-8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH*SCREEN_SCALE_FACTOR, SCREEN_HEIGHT*SCREEN_SCALE_FACTOR, SDL_WINDOW_SHOWN);
   if(window == NULL) {
     printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
-    return;
+    return 0;
   }
   renderer = SDL_CreateRenderer(window, -1, 0);
   if (renderer == NULL) {
     printf("SDL renderer could not be created.\n");
-    return;
+    return 0;
   }
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB332, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
   if (texture == NULL) {
     printf("SDL texture could not be created.\n");
-    return;
+    return 0;
   }
 
   //clear SDL screen
   SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
   SDL_RenderClear(renderer);
   SDL_RenderPresent(renderer);
+  video = 1;
+  return 1;
 }
 
 //loads game on chip 8 memory. game file size must be 3896 kb max 
 //inputs: chip8 struct and file name string
-void Chip8_loadGame (Chip8 *chip8, char *filename) {
+//output: number of bytes loaded, 0 if the file couldn't be read
+int Chip8_loadGame (Chip8 *chip8, char *filename) {
   FILE *fgame;
+  int size;
   fgame = fopen(filename, "rb");
   
   //checking if file opened
   if (fgame == NULL) {
     printf("Couldn't open the game file: %s\n", filename);
-    return;
+    return 0;
   }
 
-  fread(&(chip8->ram[RAM_PROGRAM_START]), 1, MAX_GAME_SIZE, fgame);
+  size = fread(&(chip8->ram[RAM_PROGRAM_START]), 1, MAX_GAME_SIZE, fgame);
   fclose(fgame);
 
-  return;
+  return size;
+}
+
+//checks if the display has no pixel set
+//input: chip8 struct
+int Chip8_blankDisplay(Chip8 *chip8) {
+  int i;
+
+  for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+    if (chip8->display[i])
+      return 0;
+  return 1;
 }
 
 //draws display matrix to sdl screen
+//a blank display before SDL started is skipped, since the new screen starts blank: roms
+//beginning with 00E0 don't start SDL on their first instruction
 //input: chip8 struct
 void Chip8_drawDisplay(Chip8 *chip8) {
+  unsigned long long start = 0;
+
+  if (chip8->headless || (video == 0 && Chip8_blankDisplay(chip8)) || !Chip8_initVideo())
+    return;
+  if (chip8->metrics)
+    start = Chip8_metricsNow();
   SDL_UpdateTexture(texture, NULL, chip8->display, SCREEN_WIDTH * sizeof(unsigned char));
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
+  if (chip8->metrics)
+    Chip8_metricsPresent(chip8->metrics, start);
 }
 
-void Chip8_setKey(Chip8 *chip8) {
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    if (event.type == SDL_KEYDOWN) {
-      switch (event.key.keysym.sym) {
-        case SDLK_1:
-          chip8->key = 0x1;
-        break;
-
-        case SDLK_2:
-          chip8->key = 0x2;
-        break;
-        
-        case SDLK_3:
-          chip8->key = 0x3;
-        break;
-        
-        case SDLK_4:
-          chip8->key = 0xC;
-        break;
-        
-        case SDLK_q:
-          chip8->key = 0x4;
-        break;
-
-        case SDLK_w:
-          chip8->key = 0x5;
-        break;
-        
-        case SDLK_e:
-          chip8->key = 0x6;
-        break;
-        
-        case SDLK_r:
-          chip8->key = 0xD;
-        break;
-        
-        case SDLK_a:
-          chip8->key = 0x7;
-        break;
-        
-        case SDLK_s:
-          chip8->key = 0x8;
-        break;
-        
-        case SDLK_d:
-          chip8->key = 0x9;
-        break;
-        
-        case SDLK_f:
-          chip8->key = 0xE;
-        break;
-        
-        case SDLK_z:
-          chip8->key = 0xA;
-        break;
-        
-        case SDLK_x:
-          chip8->key = 0x0;
-        break;
-        
-        case SDLK_c:
-          chip8->key = 0xB;
-        break;
-        
-        case SDLK_v:
-          chip8->key = 0xF;
-        break;
-
-        default:
-          chip8->key = 0x10;
-        break;
-      }
-    }
+//updates the key being pressed from a SDL event
+//inputs: chip8 struct and SDL event
+void Chip8_handleEvent(Chip8 *chip8, SDL_Event *event) {
+  if (chip8->metrics && (event->type == SDL_KEYDOWN || event->type == SDL_KEYUP))
+    Chip8_metricsInput(chip8->metrics);
 
-    if (event.type == SDL_KEYUP) {
-      chip8->key = 16;
+  if (event->type == SDL_KEYDOWN) {
+    switch (event->key.keysym.sym) {
+      case SDLK_1:
+        chip8->key = 0x1;
+      break;
+
+      case SDLK_2:
+        chip8->key = 0x2;
+      break;
+      
+      case SDLK_3:
+        chip8->key = 0x3;
+      break;
+      
+      case SDLK_4:
+        chip8->key = 0xC;
+      break;
+      
+      case SDLK_q:
+        chip8->key = 0x4;
+      break;
+
+      case SDLK_w:
+        chip8->key = 0x5;
+      break;
+      
+      case SDLK_e:
+        chip8->key = 0x6;
+      break;
+      
+      case SDLK_r:
+        chip8->key = 0xD;
+      break;
+      
+      case SDLK_a:
+        chip8->key = 0x7;
+      break;
+      
+      case SDLK_s:
+        chip8->key = 0x8;
+      break;
+      
+      case SDLK_d:
+        chip8->key = 0x9;
+      break;
+      
+      case SDLK_f:
+        chip8->key = 0xE;
+      break;
+      
+      case SDLK_z:
+        chip8->key = 0xA;
+      break;
+      
+      case SDLK_x:
+        chip8->key = 0x0;
+      break;
+      
+      case SDLK_c:
+        chip8->key = 0xB;
+      break;
+      
+      case SDLK_v:
+        chip8->key = 0xF;
+      break;
+
+      default:
+        chip8->key = 0x10;
+      break;
     }
   }
+
+  if (event->type == SDL_KEYUP) {
+    chip8->key = 16;
+  }
+}
+
+//stores the key being pressed from pending SDL events
+//keys only come from the window, so before the first frame there is nothing to poll and
+//SDL isn't started for it
+//input: chip8 struct
+void Chip8_setKey(Chip8 *chip8) {
+  SDL_Event event;
+  if (chip8->headless || video != 1)
+    return;
+  while (SDL_PollEvent(&event))
+    Chip8_handleEvent(chip8, &event);
+}
+
+//sleeps until a SDL event arrives or timeout ms pass, then stores the key being pressed
+//a program blocked on FX0A needs the window to get its key, so this starts SDL if needed
+//inputs: chip8 struct and timeout in ms
+//output: 1 if it waited, 0 if there is no keyboard to wait on and it returned at once
+int Chip8_waitKey(Chip8 *chip8, int timeout) {
+  SDL_Event event;
+  if (chip8->headless || !Chip8_initVideo())
+    return 0;
+  if (SDL_WaitEventTimeout(&event, timeout))
+    Chip8_handleEvent(chip8, &event);
+  Chip8_setKey(chip8);
+  return 1;
+}
+
+//60Hz timer tick: decrements the timers that are still running
+//input: chip8 struct
+void Chip8_timerTick(Chip8 *chip8) {
+  if (chip8->metrics)
+    Chip8_metricsFrame(chip8->metrics);
+  chip8->cycleCounter = 0;
+  if (chip8->delay_timer > 0)
+    chip8->delay_timer -= 1;
+  if (chip8->sound_timer > 0)
+    chip8->sound_timer -= 1;
+}
+
+//sleeps the host thread, recording the overshoot of the sleep
+//inputs: chip8 struct and time to sleep in s
+void Chip8_sleep(Chip8 *chip8, float seconds) {
+  unsigned long long start = 0;
+
+  if (chip8->metrics)
+    start = Chip8_metricsNow();
+  usleep(seconds * 1000000);
+  if (chip8->metrics)
+    Chip8_metricsSleep(chip8->metrics, start, seconds * 1000000000);
 }
 
 //timing function for the chip8
 void Chip8_tick(Chip8 *chip8) {
-  usleep(CPU_CLOCK_DELAY * 1000000);
+  Chip8_sleep(chip8, CPU_CLOCK_DELAY);
   chip8->cycleCounter += CPU_CLOCK_DELAY;
-  if (chip8->cycleCounter >= 1/60) {
-    chip8->cycleCounter = 0;
-    chip8->delay_timer -= 1;
-    chip8->sound_timer -= 1;
-  }
+  if (chip8->cycleCounter >= TIMER_DELAY)
+    Chip8_timerTick(chip8);
+}
+
+//memory writes
+
+//stores a byte in ram written by the program, marking its page as written
+//inputs: chip8 struct, address (wrapped to ram size) and value
+void Chip8_writeRam(Chip8 *chip8, unsigned short addr, unsigned char value) {
+  addr &= RAM_MASK;
+  chip8->ram[addr] = value;
+  chip8->written_pages |= 1ULL << (addr >> RAM_PAGE_SHIFT);
+}
+
+//finds the bitmap of the ram pages covering addresses [start, end)
+//inputs: first address and first address after the range, with start < end <= RAM_SIZE
+unsigned long long Chip8_pageMask(unsigned short start, unsigned short end) {
+  int first = start >> RAM_PAGE_SHIFT;
+  int count = ((end - 1) >> RAM_PAGE_SHIFT) - first + 1;
+
+  if (count == RAM_PAGES)
+    return ~0ULL;
+  return ((1ULL << count) - 1) << first;
+}
+
+//checks if the program wrote to [start, end) since the pages were last cleared
+//output: bitmap of the written pages in the range, 0 if there were no writes
+unsigned long long Chip8_writtenPages(Chip8 *chip8, unsigned short start, unsigned short end) {
+  return chip8->written_pages & Chip8_pageMask(start, end);
+}
+
+//forgets writes to the given pages, once the caches built from them were checked
+//inputs: chip8 struct and bitmap of pages
+void Chip8_clearWrittenPages(Chip8 *chip8, unsigned long long pages) {
+  chip8->written_pages &= ~pages;
+}
+
+//faults
+
+//names of the FAULT_* codes
+const char *Chip8_faultNames[] = {"none", "stack overflow", "stack underflow"};
+
+//stops execution because the program did something invalid
+//PC is left pointing to the instruction that faulted
+//inputs: chip8 struct and FAULT_* code
+void Chip8_fault(Chip8 *chip8, unsigned char fault) {
+  chip8->fault = fault;
+  chip8->PC -= 2;
 }
 
 //instructions
@@ -255,9 +364,14 @@ void instr_clearScreen(Chip8 *chip8) {
 }
 
 //00EE: returns from subroutine
+//faults with FAULT_STACK_UNDERFLOW if there is no subroutine to return from
 void instr_return(Chip8 *chip8) {
-  chip8->PC = chip8->subroutine_stack[chip8->SP];
+  if (chip8->SP == 0) {
+    Chip8_fault(chip8, FAULT_STACK_UNDERFLOW);
+    return;
+  }
   chip8->SP -= 1;
+  chip8->PC = chip8->subroutine_stack[chip8->SP];
 }
 
 //1NNN: jump to instruction in address nnn
@@ -267,11 +381,16 @@ void instr_jump(Chip8 *chip8) {
 }
 
 //2NNN: call subroutine in address nnn
+//faults with FAULT_STACK_OVERFLOW if the subroutine stack is full
 void instr_callSubroutine(Chip8 *chip8) {
   unsigned short nnn = chip8->opcode & 0x0FFF;
   
-  chip8->SP += 1;
+  if (chip8->SP == STACK_SIZE) {
+    Chip8_fault(chip8, FAULT_STACK_OVERFLOW);
+    return;
+  }
   chip8->subroutine_stack[chip8->SP] = chip8->PC;
+  chip8->SP += 1;
   chip8->PC = nnn;
 }
 
@@ -382,6 +501,8 @@ void instr_add_vx_vy(Chip8 *chip8) {
 
   if (sum > 255)
     chip8->V[0xF] = 1;
+  else
+    chip8->V[0xF] = 0;
 }
 
 //8XY5: vx gets the result of vx - vy
@@ -392,14 +513,13 @@ void instr_sub_vx_vy(Chip8 *chip8) {
   unsigned short y = chip8->opcode & 0x00F0;
   y = y >> 4;
 
-  if (chip8->V[x] > chip8->V[y])
-    chip8->V[0xF] = 1;
-  else
-    chip8->V[0xF] = 0;
+  unsigned char no_borrow = chip8->V[x] >= chip8->V[y];
 
   unsigned short sub;
   sub = chip8->V[x] - chip8->V[y];
   chip8->V[x] = sub;
+
+  chip8->V[0xF] = no_borrow;
 }
 
 //8XY6: sets vx to value of vy then shifts vx to the right
@@ -414,12 +534,10 @@ void instr_shr_vx(Chip8 *chip8) {
   if (SHIFT_INSTRUCTION == 0)
     chip8->V[x] = chip8->V[y];
   
-  if (chip8->V[x] & 0x01 == 1)
-    chip8->V[0xF] = 1;
-  else
-    chip8->V[0xF] = 0;
+  unsigned char shifted = chip8->V[x] & 0x01;
   
   chip8->V[x] = chip8->V[x] >> 1;
+  chip8->V[0xF] = shifted;
 }
 
 //8XY7: vx gets the result of vy - vx
@@ -430,17 +548,16 @@ void instr_sub_vy_vx(Chip8 *chip8) {
   unsigned short y = chip8->opcode & 0x00F0;
   y = y >> 4;
 
-  if (chip8->V[x] < chip8->V[y])
-    chip8->V[0xF] = 1;
-  else
-    chip8->V[0xF] = 0;
+  unsigned char no_borrow = chip8->V[y] >= chip8->V[x];
   
   unsigned short sub;
   sub = chip8->V[y] - chip8->V[x];
   chip8->V[x] = sub;
+
+  chip8->V[0xF] = no_borrow;
 }
 
-//8XY6: sets vx to value of vy then shifts vx to the left
+//8XYE: sets vx to value of vy then shifts vx to the left
 //or just shifts vx to the left (see SHIFT_INSTRUCTION)
 //vf gets the shifted bit
 void instr_shl_vx(Chip8 *chip8) {
@@ -452,12 +569,10 @@ void instr_shl_vx(Chip8 *chip8) {
   if (SHIFT_INSTRUCTION == 0)
     chip8->V[x] = chip8->V[y];
   
-  if (chip8->V[x] & 0x80 == 0x80)
-    chip8->V[0xF] = 1;
-  else
-    chip8->V[0xF] = 0;
+  unsigned char shifted = (chip8->V[x] & 0x80) >> 7;
   
   chip8->V[x] = chip8->V[x] << 1;
+  chip8->V[0xF] = shifted;
 }
 
 //9XY0: skips next instruction if vx != vy
@@ -508,11 +623,23 @@ void instr_draw(Chip8 *chip8) {
   x = x >> 8;
   unsigned short y = chip8->opcode & 0x00F0;
   y = y >> 4;
+  unsigned char h = chip8->opcode & 0x000F;
 
+  Chip8_drawSprite(chip8, chip8->V[x], chip8->V[y], h);
+}
+
+//draws the h pixels tall sprite pointed by the index at coordinate (vx, vy), shared by DXYN
+//and translated roms
+//vf = 1 if there is collision
+//inputs: chip8 struct, coordinates (wrapped to the screen size) and height
+void Chip8_drawSprite(Chip8 *chip8, unsigned char vx, unsigned char vy, unsigned char h) {
   //since there are more coordinates than screen space, must do modulo operation (& in binary) to find the coordinate
-  unsigned char vx = chip8->V[x] & 63;
-  unsigned char vy = chip8->V[y] & 31;
-  unsigned char h = chip8->opcode & 0x000F;
+  vx &= 63;
+  vy &= 31;
+
+  //sprites are clipped at the screen edges
+  unsigned char rows = vy + h > SCREEN_HEIGHT ? SCREEN_HEIGHT - vy : h;
+  unsigned char cols = vx + 8 > SCREEN_WIDTH ? SCREEN_WIDTH - vx : 8;
 
   //reset collision register
   chip8->V[0xF] = 0;
@@ -522,9 +649,9 @@ void instr_draw(Chip8 *chip8) {
   int i, j;
   //i represents the y coordinate
   //j represents the x coordinate
-  for (i = 0; i < h; i++) {
-    byte = chip8->ram[(chip8->I) + i];
-    for (j = 0; j < 8; j++){
+  for (i = 0; i < rows; i++) {
+    byte = chip8->ram[(chip8->I + i) & RAM_MASK];
+    for (j = 0; j < cols; j++){
       current_pixel = byte & (0x80 >> j);
       //checking if there is a collision
       if (current_pixel != 0x00) {
@@ -598,16 +725,19 @@ void instr_set_soundTimer_vx(Chip8 *chip8) {
   chip8->sound_timer = chip8->V[x];
 }
 
-//FX1E: add to index
-//vf gets 1 if i exceeds adressing range (0x0FFF)
+//FX1E: add to index, wrapping it to the addressing range (0x0FFF)
+//vf gets 1 if i exceeds adressing range, 0 otherwise
 void instr_add_i_vx(Chip8 *chip8) {
   unsigned short x = chip8->opcode & 0x0F00;
   x = x >> 8;
 
-  chip8->I =  chip8->I + chip8->V[x];
+  unsigned short sum = chip8->I + chip8->V[x];
+  chip8->I = sum & RAM_MASK;
 
-  if (chip8->I > 0x0FFF)
+  if (sum > 0x0FFF)
     chip8->V[0xF] = 1;
+  else
+    chip8->V[0xF] = 0;
 }
 
 //FX29: points i to hex char in last nibble of vx
@@ -629,9 +759,9 @@ void instr_store_vx_bcd(Chip8 *chip8) {
   unsigned char dec10 = (vx / 10) % 10;
   unsigned char dec1 = (vx % 100) % 10;
 
-  chip8->ram[chip8->I] = dec100;
-  chip8->ram[(chip8->I) + 1] = dec10;
-  chip8->ram[(chip8->I) + 2] = dec1;
+  Chip8_writeRam(chip8, chip8->I, dec100);
+  Chip8_writeRam(chip8, chip8->I + 1, dec10);
+  Chip8_writeRam(chip8, chip8->I + 2, dec1);
 
 }
 
@@ -642,7 +772,7 @@ void instr_store_v0_vx(Chip8 *chip8) {
   
   int i;
   for (i = 0; i <= x; i++)
-    chip8->ram[chip8->I + i] = chip8->V[i];
+    Chip8_writeRam(chip8, chip8->I + i, chip8->V[i]);
   if (STORE_INSTRUCTION == 0)
     chip8->I = chip8->I + x + 1;
 }
@@ -654,242 +784,220 @@ void instr_load_v0_vx(Chip8 *chip8) {
   
   int i;
   for (i = 0; i <= x; i++)
-    chip8->V[i] = chip8->ram[chip8->I + i];
+    chip8->V[i] = chip8->ram[(chip8->I + i) & RAM_MASK];
   if (STORE_INSTRUCTION == 0)
     chip8->I = chip8->I + x + 1;
 }
 
-//implementation of the instruction fetch -> decode -> execute loop of the chip 8 interpreter
-//input: initialized chip8 struct 
-void Chip8_interpreterMainLoop(Chip8 *chip8) {
-  printf("Starting loop.\n");
-  while (1) {
-    //fetch stage
-    chip8->opcode = chip8->ram[chip8->PC];
-    chip8->opcode = (chip8->opcode)<<8;
-    chip8->opcode = (chip8->opcode) | chip8->ram[(chip8->PC) + 1];
+//does nothing, used for opcodes that don't exist
+void instr_invalid(Chip8 *chip8) {
+}
+
+//decoder
+
+//instruction names, indexed by instruction identifier
+const char *Chip8_opcodeNames[OP_COUNT] = {
+  "Doesn't exist", "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0",
+  "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5",
+  "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN",
+  "EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29",
+  "FX33", "FX55", "FX65"
+};
+
+//instruction handlers, indexed by instruction identifier
+void (*Chip8_opcodeHandlers[OP_COUNT])(Chip8 *chip8) = {
+  instr_invalid, instr_clearScreen, instr_return, instr_jump, instr_callSubroutine,
+  instr_skipEq_vx_nn, instr_skipNEq_vx_nn, instr_skipEq_vx_vy, instr_set_vx_nn,
+  instr_add_vx_nn, instr_set_vx_vy, instr_or_vx_vy, instr_and_vx_vy, instr_xor_vx_vy,
+  instr_add_vx_vy, instr_sub_vx_vy, instr_shr_vx, instr_sub_vy_vx, instr_shl_vx,
+  instr_skipNEq_vx_vy, instr_set_i, instr_jumpOffset, instr_rand, instr_draw,
+  instr_skipEq_vx_key, instr_skipNEq_vx_key, instr_set_vx_delayTimer, instr_getKey,
+  instr_set_delayTimer_vx, instr_set_soundTimer_vx, instr_add_i_vx, instr_hex,
+  instr_store_vx_bcd, instr_store_v0_vx, instr_load_v0_vx
+};
+
+//decodes an opcode into its instruction identifier
+//shared by the interpreter and the rom analyser
+//input: opcode. output: OP_* identifier, OP_INVALID if it doesn't exist
+unsigned char Chip8_decode(unsigned short opcode) {
+  unsigned short opcode_nibble1 = opcode & 0xF000;
+  unsigned short opcode_nibble4 = opcode & 0x000F;
+  unsigned short opcode_byte2 = opcode & 0x00FF;
+
+  switch (opcode_nibble1) {
+    case 0x0000:
+      switch (opcode_byte2) {
+        case 0x00E0: return OP_00E0; //00E0 - clear screen
+        case 0x00EE: return OP_00EE; //00EE - return from subroutine
+        default: return OP_INVALID; //doesn't exist
+      }
 
-    unsigned short opcode_nibble1 = chip8->opcode & 0xF000;
-    unsigned short opcode_nibble4 = chip8->opcode & 0x000F;
-    unsigned short opcode_byte2 = chip8->opcode & 0x00FF;
+    case 0x1000: return OP_1NNN; //1NNN - jump to address
+    case 0x2000: return OP_2NNN; //2NNN - jump to subroutine
+    case 0x3000: return OP_3XNN; //3XNN - skip if equals (reg with val)
+    case 0x4000: return OP_4XNN; //4XNN skip if different (reg with val)
+    case 0x5000: return OP_5XY0; //5XY0 skip if equals (reg with reg)
+    case 0x6000: return OP_6XNN; //6XNN assign (val to reg)
+    case 0x7000: return OP_7XNN; //7XNN accumulate (val to reg)
+
+    case 0x8000:
+      switch (opcode_nibble4) {
+        case 0x0000: return OP_8XY0; //8XY0 assign (reg to reg)
+        case 0x0001: return OP_8XY1; //8XY1 bitwise OR (reg with reg)
+        case 0x0002: return OP_8XY2; //8XY2 bitwise AND (reg with reg)
+        case 0x0003: return OP_8XY3; //8XY3 bitwise XOR (reg with reg)
+        case 0x0004: return OP_8XY4; //8XY4 accumulate (reg to reg)
+        case 0x0005: return OP_8XY5; //8XY5 subtract then assign (reg to reg)
+        case 0x0006: return OP_8XY6; //8XY6 assign then shift right (reg by reg) or shift (reg)
+        case 0x0007: return OP_8XY7; //8XY7 neg subtract then assign (reg to reg)
+        case 0x000E: return OP_8XYE; //8XYE assign then shift left (reg by reg) or shift (reg)
+        default: return OP_INVALID; //doesn't exist
+      }
 
-    chip8->PC += 2;
+    case 0x9000: return OP_9XY0; //9XY0 skip if different (reg with reg)
+    case 0xA000: return OP_ANNN; //ANNN assign to ram pointer
+    case 0xB000: return OP_BNNN; //BNNN jump to addr + v0
+    case 0xC000: return OP_CXNN; //CXNN random number AND val
+    case 0xD000: return OP_DXYN; //DXYN draw sprite
+
+    case 0xE000:
+      switch (opcode_nibble4) {
+        case 0x000E: return OP_EX9E; //EX9E skip if key is pressed
+        case 0x0001: return OP_EXA1; //EXA1 skip if key not pressed
+        default: return OP_INVALID; //doesn't exist
+      }
 
-    //decode & execute stage
-    printf("addr: %#04X, opcode: %#04X, instruction: ", chip8->PC, chip8->opcode);
-    switch (opcode_nibble1) {
-      case 0x0000:
-        switch (opcode_byte2) {
-          case 0x00E0: //00E0 - clear screen
-            printf("00E0");
-            instr_clearScreen(chip8);
-          break;
-
-          case 0x00EE: //00EE - return from subroutine
-            printf("00EE");
-            instr_return(chip8);
-          break;
-
-          default: //doesn't exist
-            printf("Doesn't exist");
-          break;
-        }
-      break;
-      
-      case 0x1000: //1NNN - jump to address
-        printf("1NNN");
-        instr_jump(chip8);
-      break;
+    case 0xF000:
+      switch (opcode_byte2) {
+        case 0x0007: return OP_FX07; //FX07 assign delay timer to reg
+        case 0x000A: return OP_FX0A; //FX0A assign key to reg (wait for keypress)
+        case 0x0015: return OP_FX15; //FX15 assign reg to delay timer
+        case 0x0018: return OP_FX18; //FX18 assign reg to sound timer
+        case 0x001E: return OP_FX1E; //FX1E accumulate to ram pointer
+        case 0x0029: return OP_FX29; //FX29 assign ram pointer to hex char in reg (in ram region 0~0x50)
+        case 0x0033: return OP_FX33; //FX33 bcd reg
+        case 0x0055: return OP_FX55; //FX55 save regs to ram
+        case 0x0065: return OP_FX65; //FX65 load regs from ram
+        default: return OP_INVALID; //doesn't exist
+      }
+  }
+  return OP_INVALID; //doesn't exist
+}
 
-      case 0x2000: //2NNN - jump to subroutine
-        printf("2NNN");
-        instr_callSubroutine(chip8);
-      break;
+//idle loop detection
 
-      case 0x3000: //3XNN - skip if different (reg with val)
-        printf("3XNN");
-        instr_skipEq_vx_nn(chip8);
-      break;
+//detects if PC is at a wait loop with no side effects until the next timer tick or key press
+//input: chip8 struct
+//output: IDLE_TIMER for FX07; 3X00; 1NNN jumping back to the FX07 while the delay timer runs,
+//IDLE_KEY for FX0A while no key is pressed, IDLE_NONE otherwise
+unsigned char Chip8_idleLoop(Chip8 *chip8) {
+  unsigned short pc = chip8->PC;
+  unsigned char *ram = chip8->ram;
+  unsigned char x;
 
-      case 0x4000: //4XNN skip if equals (reg with val)
-        printf("4XNN");
-        instr_skipNEq_vx_nn(chip8);
-      break;
+  if (pc > RAM_SIZE - 6 || (ram[pc] & 0xF0) != 0xF0)
+    return IDLE_NONE;
+  x = ram[pc] & 0x0F;
 
-      case 0x5000: //5XY0 skip if equals (reg with reg)
-        printf("5XY0");
-        instr_skipEq_vx_vy(chip8);
-      break;
+  if (ram[pc + 1] == 0x0A)
+    return chip8->key < 16 ? IDLE_NONE : IDLE_KEY;
 
-      case 0x6000: //6XNN assign (val to reg)
-        printf("6XNN");
-        instr_set_vx_nn(chip8);
-      break;
+  if (ram[pc + 1] == 0x07 && chip8->delay_timer > 0 &&
+      ram[pc + 2] == (0x30 | x) && ram[pc + 3] == 0x00 &&
+      ram[pc + 4] == (0x10 | (pc >> 8)) && ram[pc + 5] == (pc & 0xFF))
+    return IDLE_TIMER;
 
-      case 0x7000: //7XNN accumulate (val to reg)
-        printf("7XNN");
-        instr_add_vx_nn(chip8);
-      break;
-      
-      case 0x8000:
-        switch (opcode_nibble4) {
-          case 0x0000: //8XY0 assign (reg to reg)
-            printf("8XY0");
-            instr_set_vx_vy(chip8);
-          break;
-
-          case 0x0001: //8XY1 bitwise OR (reg with reg)
-            printf("8XY1");
-            instr_or_vx_vy(chip8);
-          break;
-
-          case 0x0002: //8XY2 bitwise AND (reg with reg)
-            printf("8XY2");
-            instr_and_vx_vy(chip8);
-          break;
-
-          case 0x0003: //8XY3 bitwise XOR (reg with reg)
-            printf("8XY3");
-            instr_xor_vx_vy(chip8);
-          break;
-
-          case 0x0004: //8XY4 accumulate (reg to reg)
-            printf("8XY4");
-            instr_add_vx_vy(chip8);
-          break;
-
-          case 0x0005: //8XY5 subtract then assign (reg to reg)
-            printf("8XY5");
-            instr_sub_vx_vy(chip8);
-          break;
-
-          case 0x0006: //8XY6 assign then shift right (reg by reg) or shift (reg)
-            printf("8XY6");
-            instr_shr_vx(chip8);
-          break;
-
-          case 0x0007: //8XY7 neg subtract then assign (reg to reg)
-            printf("8XY7");
-            instr_sub_vy_vx(chip8);
-          break;
-
-          case 0x000E: //8XYE 8XY6 assign then shift left (reg by reg) or shift (reg)
-            printf("8XYE");
-            instr_shl_vx(chip8);
-          break;
-
-          default: //doesn't exist
-            printf("Doesn't exist");
-          break;
-        }
-      break;
+  return IDLE_NONE;
+}
 
-      case 0x9000: //9XY0 skip if different (reg with reg)
-        printf("9XY0");
-        instr_skipNEq_vx_vy(chip8);
-      break;
+//sleeps through a wait loop at PC until the next timer tick or key press
+//input: chip8 struct
+//output: 1 if PC was at a wait loop, 0 if the instruction at PC must be executed
+int Chip8_idleWait(Chip8 *chip8) {
+  unsigned char idle = Chip8_idleLoop(chip8);
+  float remaining = TIMER_DELAY - chip8->cycleCounter;
+
+  if (idle == IDLE_NONE)
+    return 0;
+
+  if (idle == IDLE_KEY) {
+    unsigned long long start = Chip8_metricsNow();
+    if (Chip8_waitKey(chip8, (int)(remaining * 1000) + 1)) {
+      float waited = (Chip8_metricsNow() - start) / 1e9;
+      if (waited >= remaining)
+        Chip8_timerTick(chip8);
+      else
+        chip8->cycleCounter += waited;
+      return 1;
+    }
+    //no keyboard to block on, so the wait is slept through like a timer wait
+  }
 
-      case 0xA000: //ANNN assign to ram pointer
-        printf("ANNN");
-        instr_set_i(chip8);
-      break;
+  Chip8_sleep(chip8, remaining);
+  Chip8_timerTick(chip8);
+  Chip8_setKey(chip8);
+  return 1;
+}
 
-      case 0xB000: //BNNN jump to addr + v0
-        printf("BNNN");
-        instr_jumpOffset(chip8);
-      break;
+//executes the instruction pointed by PC
+//input: initialized chip8 struct
+void Chip8_step(Chip8 *chip8) {
+  //fetch stage
+  chip8->PC &= RAM_MASK;
+  chip8->opcode = chip8->ram[chip8->PC];
+  chip8->opcode = (chip8->opcode)<<8;
+  chip8->opcode = (chip8->opcode) | chip8->ram[(chip8->PC + 1) & RAM_MASK];
 
-      case 0xC000: //CXNN random number AND val
-        printf("CXNN");
-        instr_rand(chip8);
-      break;
+  chip8->PC += 2;
 
-      case 0xD000: //DXYN draw sprite
-        printf("DXYN");
-        instr_draw(chip8);
-      break;
+  //decode stage
+  unsigned char op = Chip8_decode(chip8->opcode);
+  if (!chip8->headless)
+    printf("addr: %#04X, opcode: %#04X, instruction: %s\n", chip8->PC, chip8->opcode, Chip8_opcodeNames[op]);
 
-      case 0xE000: 
-        switch (opcode_nibble4) {
-          case 0x000E: //EX9E skip if key is pressed
-            printf("EX9E");
-            instr_skipEq_vx_key(chip8);
-          break;
-
-          case 0x0001: //EXA1 skip if key not pressed
-            printf("EXA1");
-            instr_skipNEq_vx_key(chip8);
-          break;
-
-          default: //Doesn't exist
-            printf("Doesn't exist");
-          break;
-        }
-      break;
+  //execute stage
+  Chip8_opcodeHandlers[op](chip8);
+}
 
-      case 0xF000: 
-        switch (opcode_byte2) {
-          case 0x0007: //FX07 assign delay timer to reg
-            printf("FX07");
-            instr_set_vx_delayTimer(chip8);
-          break;
-
-          case 0x000A: //FX0A assign key to reg (wait for keypress)
-            printf("FX0A");
-            instr_getKey(chip8);
-          break;
-
-          case 0x0015: //FX15 assign reg to delay timer
-            printf("FX15");
-            instr_set_delayTimer_vx(chip8);
-          break;
-
-          case 0x0018: //FX18 assign reg to sound timer
-            printf("FX18");
-            instr_set_soundTimer_vx(chip8);
-          break;
-
-          case 0x001E: //FX1E accumulate to ram pointer
-            printf("FX1E");
-            instr_add_i_vx(chip8);
-          break;
-
-          case 0x0029: //FX29 assign ram pointer to hex char in reg (in ram region 0~0x50)
-            printf("FX29");
-            instr_hex(chip8);
-          break;
-
-          case 0x0033: //FX33 bcd reg
-            printf("FX33");
-            instr_store_vx_bcd(chip8);
-          break;
-
-          case 0x0055: //FX55 save regs to ram
-            printf("FX55");
-            instr_store_v0_vx(chip8);
-          break;
-
-          case 0x0065: //FX65 load regs from ram
-            printf("FX65");
-            instr_load_v0_vx(chip8);
-          break;
-
-          default: //doesn't exist
-            printf("Doesn't exist");
-          break;
-        }
-      break;
+//finishes a cpu cycle after an instruction was executed
+//input: chip8 struct
+void Chip8_endCycle(Chip8 *chip8) {
+  if (chip8->metrics)
+    Chip8_metricsInstructions(chip8->metrics, 1);
 
-      default: //doesn't exist
-        printf("Doesn't exist");
-      break;
-    }
-    printf("\n");
+  //Store key being pressed
+  Chip8_setKey(chip8);
 
-    //Store key being pressed
-    Chip8_setKey(chip8);
+  //Slow system speed to 500Hz
+  Chip8_tick(chip8);
+}
+
+//runs one 60Hz frame of a headless chip8 without sleeping
+//a wait loop ends the frame early, since nothing changes until the next timer tick
+//input: chip8 struct initialized with Chip8_initHeadless
+void Chip8_runFrame(Chip8 *chip8) {
+  int i;
+
+  for (i = 0; i < CYCLES_PER_FRAME && chip8->fault == FAULT_NONE; i++) {
+    if (Chip8_idleLoop(chip8) != IDLE_NONE)
+      break;
+    Chip8_step(chip8);
+  }
+  if (chip8->metrics)
+    Chip8_metricsInstructions(chip8->metrics, i);
+  Chip8_timerTick(chip8);
+}
 
-    //Slow system speed to 500Hz
-    Chip8_tick(chip8);
+//implementation of the instruction fetch -> decode -> execute loop of the chip 8 interpreter
+//input: initialized chip8 struct 
+void Chip8_interpreterMainLoop(Chip8 *chip8) {
+  printf("Starting loop.\n");
+  while (chip8->fault == FAULT_NONE) {
+    //sleeps through wait loops instead of spinning on them
+    if (Chip8_idleWait(chip8))
+      continue;
+    Chip8_step(chip8);
+    Chip8_endCycle(chip8);
   }
-}
\ No newline at end of file
+  printf("Stopped at addr: %#04X, fault: %s\n", chip8->PC, Chip8_faultNames[chip8->fault]);
+}
@@ -0,0 +1,130 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include "chip8_metrics.h"
+
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+#define SCREEN_SCALE_FACTOR 10
+#define RAM_SIZE 4096
+#define RAM_MASK (RAM_SIZE - 1) //ram addresses wrap around, mirroring ram every 4 KB
+#define RAM_PROGRAM_START 512
+#define FONT_START 0x00 //4x5 hex digits, 5 bytes each
+#define FONT_BIG_START 0x50 //SuperChip 8x10 decimal digits, 10 bytes each
+#define RAM_PAGE_SHIFT 6 //ram writes are tracked in pages of 64 bytes
+#define RAM_PAGES (RAM_SIZE >> RAM_PAGE_SHIFT)
+#if RAM_PAGES > 64
+#error "written_pages is a 64 bit bitmap, RAM_PAGE_SHIFT must give 64 ram pages at most"
+#endif
+#define STACK_SIZE 16
+#define MAX_GAME_SIZE (RAM_SIZE - RAM_PROGRAM_START) //largest rom, filling ram from the program start
+#define CPU_CLOCK_DELAY 0.001 //500Hz (0.002 s) should be enough for most basic games
+#define TIMER_DELAY 0.0166667 //60Hz (0.0166667 s) for timers
+#define CYCLES_PER_FRAME 16 //instructions run between timer ticks by headless machines
+#define SHIFT_INSTRUCTION 1 //if 1, 8XY6 and 8XYE just shift vx. if 0 first sets vx to vy then shifts
+#define JUMP_INSTRUCTION 1 //if 1, BNNN uses v0, else it becomes BXNN, using vx
+#define STORE_INSTRUCTION 1 //if 1, does not increment index while storing/loading registers
+#define IDLE_NONE 0 //PC isn't at a wait loop
+#define IDLE_TIMER 1 //PC spins waiting for the delay timer
+#define IDLE_KEY 2 //PC blocks waiting for a key press
+#define FAULT_NONE 0 //program is running
+#define FAULT_STACK_OVERFLOW 1 //2NNN with STACK_SIZE subroutines already nested
+#define FAULT_STACK_UNDERFLOW 2 //00EE with an empty subroutine stack
+
+typedef struct { 
+  unsigned char ram[RAM_SIZE];
+  unsigned char display [SCREEN_WIDTH * SCREEN_HEIGHT];
+  unsigned char V[16]; //all purpose registers
+  unsigned short I; //memory address pointer
+  unsigned short PC; //program address
+  unsigned short opcode; //current opcode
+  unsigned char delay_timer; //interpreter runs while > 0
+  unsigned char sound_timer; //beeps while > 0
+  unsigned short subroutine_stack [STACK_SIZE]; //contains information to return from subroutines
+  unsigned short SP; //return addresses on the subroutine stack, the next call stores at [SP]
+  unsigned char key; //current key being pressed on keypad
+  unsigned char was_key_pressed; //variable that stores if there is currently a key being pressed
+  float cycleCounter; //stores time elapsed in s since last 60Hz timing
+  unsigned char fault; //FAULT_* code, execution stops when it isn't FAULT_NONE
+  unsigned long long written_pages; //bit n set when the program wrote to ram page n
+  unsigned char headless; //if 1, there is no SDL screen or keyboard and no instruction trace
+  Chip8Metrics *metrics; //live instrumentation, NULL when it is off
+} Chip8;
+
+//instruction identifiers returned by Chip8_decode
+enum {
+  OP_INVALID, OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0,
+  OP_6XNN, OP_7XNN, OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5,
+  OP_8XY6, OP_8XY7, OP_8XYE, OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN,
+  OP_EX9E, OP_EXA1, OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29,
+  OP_FX33, OP_FX55, OP_FX65, OP_COUNT
+};
+
+//emulator
+void Chip8_reset(Chip8 *chip8);
+void Chip8_initHeadless(Chip8 *chip8);
+void Chip8_init(Chip8 *chip8);
+int Chip8_initVideo(void);
+int Chip8_loadGame(Chip8 *chip8, char *filename);
+int Chip8_blankDisplay(Chip8 *chip8);
+void Chip8_drawDisplay(Chip8 *chip8);
+void Chip8_setKey(Chip8 *chip8);
+int Chip8_waitKey(Chip8 *chip8, int timeout);
+void Chip8_timerTick(Chip8 *chip8);
+void Chip8_sleep(Chip8 *chip8, float seconds);
+void Chip8_tick(Chip8 *chip8);
+unsigned char Chip8_idleLoop(Chip8 *chip8);
+int Chip8_idleWait(Chip8 *chip8);
+unsigned char Chip8_decode(unsigned short opcode);
+extern const char *Chip8_opcodeNames[OP_COUNT];
+extern void (*Chip8_opcodeHandlers[OP_COUNT])(Chip8 *chip8);
+extern const char *Chip8_faultNames[];
+void Chip8_step(Chip8 *chip8);
+void Chip8_endCycle(Chip8 *chip8);
+void Chip8_runFrame(Chip8 *chip8);
+void Chip8_interpreterMainLoop(Chip8 *chip8);
+void Chip8_fault(Chip8 *chip8, unsigned char fault);
+void Chip8_writeRam(Chip8 *chip8, unsigned short addr, unsigned char value);
+unsigned long long Chip8_pageMask(unsigned short start, unsigned short end);
+unsigned long long Chip8_writtenPages(Chip8 *chip8, unsigned short start, unsigned short end);
+void Chip8_clearWrittenPages(Chip8 *chip8, unsigned long long pages);
+
+//instructions
+void instr_clearScreen(Chip8 *chip8);
+void instr_return(Chip8 *chip8);
+void instr_jump(Chip8 *chip8);
+void instr_callSubroutine(Chip8 *chip8);
+void instr_skipEq_vx_nn(Chip8 *chip8);
+void instr_skipNEq_vx_nn(Chip8 *chip8);
+void instr_skipEq_vx_vy(Chip8 *chip8);
+void instr_set_vx_nn(Chip8 *chip8);
+void instr_add_vx_nn(Chip8 *chip8);
+void instr_set_vx_vy(Chip8 *chip8);
+void instr_or_vx_vy(Chip8 *chip8);
+void instr_and_vx_vy(Chip8 *chip8);
+void instr_xor_vx_vy(Chip8 *chip8);
+void instr_add_vx_vy(Chip8 *chip8);
+void instr_sub_vx_vy(Chip8 *chip8);
+void instr_shr_vx(Chip8 *chip8);
+void instr_sub_vy_vx(Chip8 *chip8);
+void instr_shl_vx(Chip8 *chip8);
+void instr_skipNEq_vx_vy(Chip8 *chip8);
+void instr_set_i(Chip8 *chip8);
+void instr_jumpOffset(Chip8 *chip8);
+void instr_rand(Chip8 *chip8);
+void instr_draw(Chip8 *chip8);
+void Chip8_drawSprite(Chip8 *chip8, unsigned char vx, unsigned char vy, unsigned char h);
+void instr_skipEq_vx_key(Chip8 *chip8);
+void instr_skipNEq_vx_key(Chip8 *chip8);
+void instr_set_vx_delayTimer(Chip8 *chip8);
+void instr_getKey(Chip8 *chip8);
+void instr_set_delayTimer_vx(Chip8 *chip8);
+void instr_set_soundTimer_vx(Chip8 *chip8);
+void instr_add_i_vx(Chip8 *chip8);
+void instr_hex(Chip8 *chip8);
+void instr_store_vx_bcd(Chip8 *chip8);
+void instr_store_v0_vx(Chip8 *chip8);
+void instr_load_v0_vx(Chip8 *chip8);
+void instr_invalid(Chip8 *chip8);
+
+#endif
@@ -0,0 +1,169 @@
+#include <string.h>
+#include "chip8_analysis.h"
+
+
+//reads the opcode stored at addr
+unsigned short Chip8_opcodeAt(unsigned char *ram, unsigned short addr) {
+  return (ram[addr] << 8) | ram[(addr + 1) & (RAM_SIZE - 1)];
+}
+
+//finds where control can go after the instruction at addr
+//BNNN only reports its base address, since v0 is unknown before running
+//inputs: address, opcode and output array of MAX_SUCCESSORS addresses
+//output: number of successors, 0 if the instruction ends the path
+int Chip8_successors(unsigned short addr, unsigned short opcode, unsigned short *succ) {
+  unsigned short nnn = opcode & 0x0FFF;
+
+  switch (Chip8_decode(opcode)) {
+    case OP_INVALID:
+    case OP_00EE:
+      return 0;
+
+    case OP_1NNN:
+    case OP_BNNN:
+      succ[0] = nnn;
+      return 1;
+
+    case OP_2NNN:
+      succ[0] = nnn;
+      succ[1] = addr + 2;
+      return 2;
+
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+    case OP_EX9E:
+    case OP_EXA1:
+      succ[0] = addr + 2;
+      succ[1] = addr + 4;
+      return 2;
+
+    default:
+      succ[0] = addr + 2;
+      return 1;
+  }
+}
+
+//checks if the instruction at addr can only fall through to the next one
+int Chip8_isStraightLine(unsigned short addr, unsigned short opcode) {
+  unsigned short succ[MAX_SUCCESSORS];
+  return Chip8_successors(addr, opcode, succ) == 1 && succ[0] == addr + 2;
+}
+
+//checks if an address lies inside the loaded rom
+int Chip8_inRom(Chip8Analysis *analysis, unsigned short addr) {
+  return addr >= RAM_PROGRAM_START && addr + 1 < analysis->rom_end;
+}
+
+//finds the first address after the basic block starting at addr
+unsigned short Chip8_blockEnd(Chip8Analysis *analysis, unsigned char *ram, unsigned short addr) {
+  while (1) {
+    unsigned short opcode = Chip8_opcodeAt(ram, addr);
+    if (!Chip8_isStraightLine(addr, opcode))
+      return addr + 2;
+    addr += 2;
+    if (!Chip8_inRom(analysis, addr) || !(analysis->flags[addr] & ANALYSIS_CODE) ||
+        (analysis->flags[addr] & ANALYSIS_LEADER))
+      return addr;
+  }
+}
+
+//marks the sprite bytes read by DXYN instructions after an ANNN inside each block
+void Chip8_markData(Chip8Analysis *analysis, unsigned char *ram) {
+  unsigned short addr, end, i;
+
+  for (addr = RAM_PROGRAM_START; addr < analysis->rom_end; addr++) {
+    if (!(analysis->flags[addr] & ANALYSIS_LEADER) || !(analysis->flags[addr] & ANALYSIS_CODE))
+      continue;
+
+    int index = -1;
+    end = Chip8_blockEnd(analysis, ram, addr);
+    for (i = addr; i < end; i += 2) {
+      unsigned short opcode = Chip8_opcodeAt(ram, i);
+      unsigned char op = Chip8_decode(opcode);
+
+      if (op == OP_ANNN) {
+        index = opcode & 0x0FFF;
+        if (Chip8_inRom(analysis, index))
+          analysis->flags[index] |= ANALYSIS_DATA;
+      }
+      else if (op == OP_FX1E || op == OP_FX29) {
+        index = -1;
+      }
+      else if (op == OP_DXYN && index >= 0) {
+        int n;
+        for (n = 0; n < (opcode & 0x000F) && index + n < analysis->rom_end; n++)
+          analysis->flags[index + n] |= ANALYSIS_DATA;
+      }
+    }
+  }
+}
+
+//follows every reachable path from the rom entry point, splitting code from data
+//and finding basic blocks and subroutines
+//inputs: analysis struct, ram with a loaded game and size of the game in bytes
+void Chip8_analyse(Chip8Analysis *analysis, unsigned char *ram, int rom_size) {
+  unsigned short worklist[2 * RAM_SIZE]; //every visited instruction pushes at most 2 successors
+  unsigned short succ[MAX_SUCCESSORS];
+  int top = 0;
+  int i, n;
+
+  memset(analysis, 0, sizeof(Chip8Analysis));
+  analysis->rom_end = RAM_PROGRAM_START + rom_size;
+
+  worklist[top++] = RAM_PROGRAM_START;
+  analysis->flags[RAM_PROGRAM_START] |= ANALYSIS_LEADER;
+
+  while (top > 0) {
+    unsigned short addr = worklist[--top];
+
+    //walks a straight line of code until reaching already visited code
+    while (Chip8_inRom(analysis, addr) && !(analysis->flags[addr] & ANALYSIS_CODE)) {
+      unsigned short opcode = Chip8_opcodeAt(ram, addr);
+      unsigned char op = Chip8_decode(opcode);
+
+      if (op == OP_INVALID)
+        break;
+
+      analysis->flags[addr] |= ANALYSIS_CODE;
+      analysis->flags[addr + 1] |= ANALYSIS_OPERAND;
+
+      n = Chip8_successors(addr, opcode, succ);
+      if (op == OP_2NNN && Chip8_inRom(analysis, succ[0]))
+        analysis->flags[succ[0]] |= ANALYSIS_SUBROUTINE;
+      if (op == OP_BNNN && Chip8_inRom(analysis, succ[0]))
+        analysis->flags[succ[0]] |= ANALYSIS_INDIRECT;
+
+      if (n == 1 && succ[0] == addr + 2) {
+        addr += 2;
+        continue;
+      }
+
+      //any other control flow ends the block and starts new ones on its successors
+      for (i = 0; i < n; i++) {
+        if (!Chip8_inRom(analysis, succ[i]))
+          continue;
+        analysis->flags[succ[i]] |= ANALYSIS_LEADER;
+        if (!(analysis->flags[succ[i]] & ANALYSIS_CODE))
+          worklist[top++] = succ[i];
+      }
+      break;
+    }
+  }
+
+  Chip8_markData(analysis, ram);
+
+  for (i = RAM_PROGRAM_START; i < analysis->rom_end; i++) {
+    unsigned char flags = analysis->flags[i];
+    if (flags & ANALYSIS_CODE) {
+      analysis->code_bytes += 2;
+      if (flags & ANALYSIS_LEADER)
+        analysis->block_count++;
+      if (flags & ANALYSIS_SUBROUTINE)
+        analysis->subroutine_count++;
+    }
+    if ((flags & ANALYSIS_DATA) && !(flags & (ANALYSIS_CODE | ANALYSIS_OPERAND)))
+      analysis->data_bytes++;
+  }
+}
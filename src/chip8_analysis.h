@@ -0,0 +1,32 @@
+#ifndef CHIP8_ANALYSIS_H
+#define CHIP8_ANALYSIS_H
+
+#include "chip8.h"
+
+//flags stored for each ram address by the analyser
+#define ANALYSIS_CODE 0x01 //first byte of a reachable instruction
+#define ANALYSIS_OPERAND 0x02 //second byte of a reachable instruction
+#define ANALYSIS_LEADER 0x04 //instruction starts a basic block
+#define ANALYSIS_SUBROUTINE 0x08 //instruction is the target of a 2NNN
+#define ANALYSIS_DATA 0x10 //byte is referenced by ANNN or read by DXYN
+#define ANALYSIS_INDIRECT 0x20 //instruction is the base of a BNNN jump
+#define MAX_SUCCESSORS 2
+
+typedef struct {
+  unsigned char flags[RAM_SIZE]; //ANALYSIS_* flags for each address
+  unsigned short rom_end; //first address after the loaded rom
+  int block_count; //number of basic blocks found
+  int subroutine_count; //number of subroutine entry points found
+  int code_bytes; //bytes covered by reachable instructions
+  int data_bytes; //bytes referenced as sprite or table data
+} Chip8Analysis;
+
+unsigned short Chip8_opcodeAt(unsigned char *ram, unsigned short addr);
+int Chip8_successors(unsigned short addr, unsigned short opcode, unsigned short *succ);
+int Chip8_isStraightLine(unsigned short addr, unsigned short opcode);
+int Chip8_inRom(Chip8Analysis *analysis, unsigned short addr);
+unsigned short Chip8_blockEnd(Chip8Analysis *analysis, unsigned char *ram, unsigned short addr);
+void Chip8_markData(Chip8Analysis *analysis, unsigned char *ram);
+void Chip8_analyse(Chip8Analysis *analysis, unsigned char *ram, int rom_size);
+
+#endif
@@ -0,0 +1,460 @@
+#include <dlfcn.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8_analysis.h"
+#include "chip8_aot.h"
+
+#ifndef AOT_INCLUDE_DIR
+#define AOT_INCLUDE_DIR "src" //where the generated code finds chip8_aot.h
+#endif
+#ifdef __APPLE__
+//emulator functions are resolved from the emulator when the translated rom is loaded
+#define AOT_LINK_FLAGS "-undefined", "dynamic_lookup",
+#else
+#define AOT_LINK_FLAGS
+#endif
+
+//FNV-1a hash of the rom contents, used with Chip8_aotAbi as the cache key
+unsigned long long Chip8_aotHash(unsigned char *data, int size) {
+  unsigned long long hash = 0xCBF29CE484222325ULL;
+  int i;
+
+  for (i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+//identifies what translated roms depend on besides the rom: the translator version, the
+//instruction variants compiled in and the layout of the chip8 struct they access. cached objects built for another one are rejected
+unsigned long long Chip8_aotAbi(void) {
+  unsigned long long layout[] = {
+    AOT_VERSION, SHIFT_INSTRUCTION, JUMP_INSTRUCTION, STORE_INSTRUCTION, sizeof(Chip8),
+    offsetof(Chip8, ram), offsetof(Chip8, display), offsetof(Chip8, V), offsetof(Chip8, I),
+    offsetof(Chip8, PC), offsetof(Chip8, delay_timer), offsetof(Chip8, sound_timer),
+    offsetof(Chip8, subroutine_stack), offsetof(Chip8, SP), offsetof(Chip8, key),
+    offsetof(Chip8, was_key_pressed), offsetof(Chip8, fault)
+  };
+  return Chip8_aotHash((unsigned char *) layout, sizeof(layout));
+}
+
+//checks if a translated block must return to the dispatcher after this instruction
+//FX0A may rewind PC, and FX33/FX55 may overwrite code, which is checked between blocks
+int Chip8_aotEndsBlock(unsigned char op) {
+  return op == OP_FX0A || op == OP_FX33 || op == OP_FX55;
+}
+
+//writes the C code of one instruction, with its operands as constants
+//control flow only happens at the end of a block, where the code sets PC and returns the
+//number of instructions the block ran
+//inputs: output file, address and opcode of the instruction and instructions run up to it
+//output: 1 if the code returns, 0 if it falls through to the next instruction
+int Chip8_aotTranslateInstruction(FILE *out, unsigned short addr, unsigned short opcode, int count) {
+  unsigned char op = Chip8_decode(opcode);
+  unsigned char x = (opcode & 0x0F00) >> 8;
+  unsigned char y = (opcode & 0x00F0) >> 4;
+  unsigned char n = opcode & 0x000F;
+  unsigned char nn = opcode & 0x00FF;
+  unsigned short nnn = opcode & 0x0FFF;
+  int i;
+
+  fprintf(out, "  //0x%03X: %04X %s\n", addr, opcode, Chip8_opcodeNames[op]);
+  switch (op) {
+    case OP_00E0:
+      fprintf(out, "  memset(chip8->display, 0, sizeof(chip8->display));\n");
+      fprintf(out, "  Chip8_drawDisplay(chip8);\n");
+      return 0;
+
+    case OP_00EE:
+      fprintf(out, "  if (chip8->SP == 0) {\n");
+      fprintf(out, "    chip8->PC = 0x%03X;\n", addr + 2);
+      fprintf(out, "    Chip8_fault(chip8, FAULT_STACK_UNDERFLOW);\n");
+      fprintf(out, "    return %d;\n  }\n", count);
+      fprintf(out, "  chip8->SP -= 1;\n");
+      fprintf(out, "  chip8->PC = chip8->subroutine_stack[chip8->SP];\n");
+      fprintf(out, "  return %d;\n", count);
+      return 1;
+
+    case OP_1NNN:
+      fprintf(out, "  chip8->PC = 0x%03X;\n  return %d;\n", nnn, count);
+      return 1;
+
+    case OP_2NNN:
+      fprintf(out, "  if (chip8->SP == STACK_SIZE) {\n");
+      fprintf(out, "    chip8->PC = 0x%03X;\n", addr + 2);
+      fprintf(out, "    Chip8_fault(chip8, FAULT_STACK_OVERFLOW);\n");
+      fprintf(out, "    return %d;\n  }\n", count);
+      fprintf(out, "  chip8->subroutine_stack[chip8->SP] = 0x%03X;\n", addr + 2);
+      fprintf(out, "  chip8->SP += 1;\n");
+      fprintf(out, "  chip8->PC = 0x%03X;\n  return %d;\n", nnn, count);
+      return 1;
+
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+    case OP_EX9E:
+    case OP_EXA1:
+      fprintf(out, "  chip8->PC = V[%d] ", x);
+      if (op == OP_3XNN || op == OP_4XNN)
+        fprintf(out, "%s 0x%02X", op == OP_3XNN ? "==" : "!=", nn);
+      else if (op == OP_5XY0 || op == OP_9XY0)
+        fprintf(out, "%s V[%d]", op == OP_5XY0 ? "==" : "!=", y);
+      else
+        fprintf(out, "%s chip8->key", op == OP_EX9E ? "==" : "!=");
+      fprintf(out, " ? 0x%03X : 0x%03X;\n  return %d;\n", addr + 4, addr + 2, count);
+      return 1;
+
+    case OP_6XNN: fprintf(out, "  V[%d] = 0x%02X;\n", x, nn); return 0;
+    case OP_7XNN: fprintf(out, "  V[%d] += 0x%02X;\n", x, nn); return 0;
+    case OP_8XY0: fprintf(out, "  V[%d] = V[%d];\n", x, y); return 0;
+    case OP_8XY1: fprintf(out, "  V[%d] |= V[%d];\n", x, y); return 0;
+    case OP_8XY2: fprintf(out, "  V[%d] &= V[%d];\n", x, y); return 0;
+    case OP_8XY3: fprintf(out, "  V[%d] ^= V[%d];\n", x, y); return 0;
+
+    //vf is written last, so it holds the flag even when it is vx
+    case OP_8XY4:
+      fprintf(out, "  sum = V[%d] + V[%d];\n  V[%d] = sum;\n  V[0xF] = sum > 255;\n", x, y, x);
+      return 0;
+
+    case OP_8XY5:
+      fprintf(out, "  flag = V[%d] >= V[%d];\n  V[%d] = V[%d] - V[%d];\n  V[0xF] = flag;\n", x, y, x, x, y);
+      return 0;
+
+    case OP_8XY7:
+      fprintf(out, "  flag = V[%d] >= V[%d];\n  V[%d] = V[%d] - V[%d];\n  V[0xF] = flag;\n", y, x, x, y, x);
+      return 0;
+
+    case OP_8XY6:
+    case OP_8XYE:
+      if (SHIFT_INSTRUCTION == 0)
+        fprintf(out, "  V[%d] = V[%d];\n", x, y);
+      if (op == OP_8XY6)
+        fprintf(out, "  flag = V[%d] & 0x01;\n  V[%d] >>= 1;\n", x, x);
+      else
+        fprintf(out, "  flag = V[%d] >> 7;\n  V[%d] <<= 1;\n", x, x);
+      fprintf(out, "  V[0xF] = flag;\n");
+      return 0;
+
+    case OP_ANNN: fprintf(out, "  chip8->I = 0x%03X;\n", nnn); return 0;
+
+    case OP_BNNN:
+      if (JUMP_INSTRUCTION == 1)
+        fprintf(out, "  chip8->PC = 0x%03X + V[0];\n", nnn);
+      else
+        fprintf(out, "  chip8->PC = 0x%02X + V[%d];\n", nn, x);
+      fprintf(out, "  return %d;\n", count);
+      return 1;
+
+    case OP_CXNN: fprintf(out, "  V[%d] = (unsigned char) rand() & 0x%02X;\n", x, nn); return 0;
+    case OP_DXYN: fprintf(out, "  Chip8_drawSprite(chip8, V[%d], V[%d], %d);\n", x, y, n); return 0;
+    case OP_FX07: fprintf(out, "  V[%d] = chip8->delay_timer;\n", x); return 0;
+
+    //the block ends here, so PC only rewinds when there is no key yet
+    case OP_FX0A:
+      fprintf(out, "  chip8->was_key_pressed = chip8->key < 16;\n");
+      fprintf(out, "  if (!chip8->was_key_pressed) {\n");
+      fprintf(out, "    chip8->PC = 0x%03X;\n    return %d;\n  }\n", addr, count);
+      fprintf(out, "  V[%d] = chip8->key;\n", x);
+      return 0;
+
+    case OP_FX15: fprintf(out, "  chip8->delay_timer = V[%d];\n", x); return 0;
+    case OP_FX18: fprintf(out, "  chip8->sound_timer = V[%d];\n", x); return 0;
+
+    case OP_FX1E:
+      fprintf(out, "  sum = chip8->I + V[%d];\n  chip8->I = sum & RAM_MASK;\n  V[0xF] = sum > 0x0FFF;\n", x);
+      return 0;
+
+    case OP_FX29: fprintf(out, "  chip8->I = (V[%d] & 0x0F) * 5;\n", x); return 0;
+
+    case OP_FX33:
+      fprintf(out, "  Chip8_writeRam(chip8, chip8->I, V[%d] / 100);\n", x);
+      fprintf(out, "  Chip8_writeRam(chip8, chip8->I + 1, (V[%d] / 10) %% 10);\n", x);
+      fprintf(out, "  Chip8_writeRam(chip8, chip8->I + 2, V[%d] %% 10);\n", x);
+      return 0;
+
+    case OP_FX55:
+    case OP_FX65:
+      for (i = 0; i <= x; i++) {
+        if (op == OP_FX55)
+          fprintf(out, "  Chip8_writeRam(chip8, chip8->I + %d, V[%d]);\n", i, i);
+        else
+          fprintf(out, "  V[%d] = chip8->ram[(chip8->I + %d) & RAM_MASK];\n", i, i);
+      }
+      if (STORE_INSTRUCTION == 0)
+        fprintf(out, "  chip8->I += %d;\n", x + 1);
+      return 0;
+
+    //doesn't exist, does nothing like instr_invalid
+    default:
+      return 0;
+  }
+}
+
+//writes the translated function of the instructions in [start, end)
+//it returns the number of instructions run, so the caller does the timing once per block
+void Chip8_aotTranslateBlock(FILE *out, unsigned char *ram, unsigned short start, unsigned short end) {
+  unsigned short addr;
+  int count = 0;
+  int returns = 0;
+
+  fprintf(out, "static int aot_%03X(Chip8 *chip8) {\n", start);
+  fprintf(out, "  unsigned char *V = chip8->V;\n");
+  fprintf(out, "  unsigned short sum;\n");
+  fprintf(out, "  unsigned char flag;\n\n");
+  for (addr = start; addr < end; addr += 2)
+    returns = Chip8_aotTranslateInstruction(out, addr, Chip8_opcodeAt(ram, addr), ++count);
+  if (!returns)
+    fprintf(out, "  chip8->PC = 0x%03X;\n  return %d;\n", end, count);
+  fprintf(out, "}\n\n");
+}
+
+//translates a loaded rom into C code with one function per basic block
+//inputs: output file, ram with a loaded game and size of the game in bytes
+void Chip8_aotTranslate(FILE *out, unsigned char *ram, int rom_size) {
+  Chip8Analysis analysis;
+  unsigned short starts[RAM_SIZE];
+  unsigned short ends[RAM_SIZE];
+  unsigned short addr, end, start, i;
+  int count = 0;
+
+  Chip8_analyse(&analysis, ram, rom_size);
+
+  fprintf(out, "#include <stdlib.h>\n");
+  fprintf(out, "#include <string.h>\n");
+  fprintf(out, "#include \"chip8_aot.h\"\n\n");
+
+  fprintf(out, "const unsigned long long Chip8_aotAbiVersion = 0x%016llxULL;\n", Chip8_aotAbi());
+  fprintf(out, "const int Chip8_aotRomSize = %d;\n", rom_size);
+  fprintf(out, "const unsigned char Chip8_aotRom[] = {");
+  for (i = 0; i < rom_size; i++)
+    fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n  " : " ", ram[RAM_PROGRAM_START + i]);
+  fprintf(out, "\n};\n\n");
+
+  for (addr = RAM_PROGRAM_START; addr < analysis.rom_end; addr++) {
+    if (!(analysis.flags[addr] & ANALYSIS_CODE) || !(analysis.flags[addr] & ANALYSIS_LEADER))
+      continue;
+
+    end = Chip8_blockEnd(&analysis, ram, addr);
+    start = addr;
+    for (i = addr; i < end; i += 2) {
+      if (i + 2 == end || Chip8_aotEndsBlock(Chip8_decode(Chip8_opcodeAt(ram, i)))) {
+        Chip8_aotTranslateBlock(out, ram, start, i + 2);
+        starts[count] = start;
+        ends[count] = i + 2;
+        count++;
+        start = i + 2;
+      }
+    }
+  }
+
+  fprintf(out, "const int Chip8_aotBlockCount = %d;\n", count);
+  fprintf(out, "const Chip8AotBlock Chip8_aotBlocks[] = {\n");
+  for (i = 0; i < count; i++)
+    fprintf(out, "  {0x%03X, 0x%03X, aot_%03X},\n", starts[i], ends[i], starts[i]);
+  fprintf(out, "  {0, 0, 0}\n};\n");
+}
+
+//finds the cached shared object path for a rom
+//inputs: ram with a loaded game, size of the game and output path buffer of AOT_PATH_SIZE
+void Chip8_aotPath(unsigned char *ram, int rom_size, char *path, char *extension) {
+  char *dir = getenv("CHIP8_AOT_CACHE");
+  if (dir == NULL)
+    dir = AOT_CACHE_DIR;
+
+  snprintf(path, AOT_PATH_SIZE, "%s/%016llx-%016llx.%s", dir,
+           Chip8_aotHash(&ram[RAM_PROGRAM_START], rom_size), Chip8_aotAbi(), extension);
+}
+
+//compiles a translated rom into a shared object
+//the compiler runs without a shell, so paths with spaces or shell characters are passed as is
+//inputs: path of the C code and path of the shared object
+//output: 1 if it compiled
+int Chip8_aotCompile(char *c_path, char *so_path) {
+  char *args[] = {
+    "cc", "-shared", "-fPIC", "-O2", AOT_LINK_FLAGS "-I", AOT_INCLUDE_DIR, "-x", "c", "-o", so_path, c_path, NULL
+  };
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0)
+    return 0;
+  if (pid == 0) {
+    execvp(args[0], args);
+    _exit(127);
+  }
+  if (waitpid(pid, &status, 0) < 0)
+    return 0;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//translates a rom and compiles it into the cache, unless it is already there
+//both files are written under unique temporary names and renamed into place, so another
+//emulator never loads a half written object
+//inputs: ram with a loaded game and size of the game in bytes
+//output: 1 if the shared object is in the cache, 0 if it couldn't be built
+int Chip8_aotBuild(unsigned char *ram, int rom_size) {
+  char so_path[AOT_PATH_SIZE];
+  char c_path[AOT_PATH_SIZE];
+  char so_temp[AOT_PATH_SIZE + 8];
+  char c_temp[AOT_PATH_SIZE + 8];
+  char *dir = getenv("CHIP8_AOT_CACHE");
+  FILE *out;
+  int fd;
+
+  Chip8_aotPath(ram, rom_size, so_path, "so");
+  if (access(so_path, R_OK) == 0)
+    return 1;
+
+  mkdir(dir == NULL ? AOT_CACHE_DIR : dir, 0755);
+
+  Chip8_aotPath(ram, rom_size, c_path, "c");
+  snprintf(c_temp, sizeof(c_temp), "%s.XXXXXX", c_path);
+  fd = mkstemp(c_temp);
+  out = fd < 0 ? NULL : fdopen(fd, "w");
+  if (out == NULL) {
+    printf("Couldn't write the translated rom: %s\n", c_path);
+    if (fd >= 0) {
+      close(fd);
+      unlink(c_temp);
+    }
+    return 0;
+  }
+  Chip8_aotTranslate(out, ram, rom_size);
+  fclose(out);
+
+  snprintf(so_temp, sizeof(so_temp), "%s.XXXXXX", so_path);
+  fd = mkstemp(so_temp);
+  if (fd < 0 || !Chip8_aotCompile(c_temp, so_temp)) {
+    printf("Couldn't compile the translated rom: %s\n", c_path);
+    if (fd >= 0) {
+      close(fd);
+      unlink(so_temp);
+    }
+    unlink(c_temp);
+    return 0;
+  }
+  close(fd);
+  chmod(c_temp, 0644);
+  chmod(so_temp, 0755);
+
+  //the C code is kept next to the object to read what was generated
+  rename(c_temp, c_path);
+  if (rename(so_temp, so_path) != 0) {
+    printf("Couldn't store the translated rom: %s\n", so_path);
+    unlink(so_temp);
+    return 0;
+  }
+  return 1;
+}
+
+//loads the translated rom from the cache, translating it first if needed
+//inputs: aot struct, ram with a loaded game and size of the game in bytes
+//output: 1 if translated blocks are available, 0 to fall back to the interpreter
+int Chip8_aotLoad(Chip8Aot *aot, unsigned char *ram, int rom_size) {
+  char path[AOT_PATH_SIZE];
+  const Chip8AotBlock *blocks;
+  const unsigned long long *abi;
+  const int *size;
+  int i;
+
+  memset(aot, 0, sizeof(Chip8Aot));
+
+  if (!Chip8_aotBuild(ram, rom_size))
+    return 0;
+
+  Chip8_aotPath(ram, rom_size, path, "so");
+  aot->handle = dlopen(path, RTLD_NOW);
+  if (aot->handle == NULL) {
+    printf("Couldn't load the translated rom: %s\n", dlerror());
+    return 0;
+  }
+
+  abi = dlsym(aot->handle, "Chip8_aotAbiVersion");
+  size = dlsym(aot->handle, "Chip8_aotRomSize");
+  aot->rom = dlsym(aot->handle, "Chip8_aotRom");
+  blocks = dlsym(aot->handle, "Chip8_aotBlocks");
+
+  //checking the cache entry really belongs to this rom and this build of the emulator
+  if (abi == NULL || *abi != Chip8_aotAbi() ||
+      size == NULL || aot->rom == NULL || blocks == NULL || *size != rom_size ||
+      memcmp(aot->rom, &ram[RAM_PROGRAM_START], rom_size) != 0) {
+    printf("Translated rom doesn't match: %s\n", path);
+    dlclose(aot->handle);
+    aot->handle = NULL;
+    return 0;
+  }
+
+  for (i = 0; blocks[i].function != NULL; i++) {
+    aot->blocks[blocks[i].start] = blocks[i].function;
+    aot->block_end[blocks[i].start] = blocks[i].end;
+    aot->code_pages |= Chip8_pageMask(blocks[i].start, blocks[i].end);
+  }
+  return 1;
+}
+
+//drops the translated blocks whose bytes were overwritten since translation
+//only blocks on code pages written since the last call are compared with the rom, and only
+//the code pages are cleared, leaving writes elsewhere to other caches
+//dropped blocks are run by the interpreter from then on
+void Chip8_aotInvalidate(Chip8 *chip8, Chip8Aot *aot) {
+  unsigned long long written = Chip8_writtenPages(chip8, RAM_PROGRAM_START, RAM_SIZE) & aot->code_pages;
+  unsigned short addr, end;
+
+  if (written == 0)
+    return;
+  Chip8_clearWrittenPages(chip8, aot->code_pages);
+
+  for (addr = RAM_PROGRAM_START; addr < RAM_SIZE; addr++) {
+    if (aot->blocks[addr] == NULL)
+      continue;
+    end = aot->block_end[addr];
+    if ((Chip8_pageMask(addr, end) & written) &&
+        memcmp(&chip8->ram[addr], &aot->rom[addr - RAM_PROGRAM_START], end - addr) != 0)
+      aot->blocks[addr] = NULL;
+  }
+}
+
+//finishes the cpu cycles of a translated block at once: one key poll and one sleep per block
+//instead of one per instruction, ticking the timers for each TIMER_DELAY the block took
+//inputs: chip8 struct and number of instructions the block ran
+void Chip8_aotEndBlock(Chip8 *chip8, int cycles) {
+  float late;
+
+  if (chip8->metrics)
+    Chip8_metricsInstructions(chip8->metrics, cycles);
+  Chip8_setKey(chip8);
+  Chip8_sleep(chip8, cycles * CPU_CLOCK_DELAY);
+  chip8->cycleCounter += cycles * CPU_CLOCK_DELAY;
+  while (chip8->cycleCounter >= TIMER_DELAY) {
+    late = chip8->cycleCounter - TIMER_DELAY;
+    Chip8_timerTick(chip8);
+    chip8->cycleCounter = late;
+  }
+}
+
+//runs translated blocks when there is one at PC, or the interpreter otherwise
+//inputs: initialized chip8 struct with the game loaded and loaded aot struct
+void Chip8_aotMainLoop(Chip8 *chip8, Chip8Aot *aot) {
+  printf("Starting translated loop.\n");
+  while (chip8->fault == FAULT_NONE) {
+    if (Chip8_idleWait(chip8))
+      continue;
+    Chip8_aotInvalidate(chip8, aot);
+    chip8->PC &= RAM_MASK;
+    if (aot->blocks[chip8->PC] != NULL) {
+      Chip8_aotEndBlock(chip8, aot->blocks[chip8->PC](chip8));
+    }
+    else {
+      Chip8_step(chip8);
+      Chip8_endCycle(chip8);
+    }
+  }
+  printf("Stopped at addr: %#04X, fault: %s\n", chip8->PC, Chip8_faultNames[chip8->fault]);
+}
@@ -0,0 +1,43 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stdio.h>
+#include "chip8.h"
+
+//translated code for a run of instructions, executed in place of the interpreter
+//returns the number of instructions it ran
+typedef int (*Chip8AotFunction)(Chip8 *chip8);
+
+//basic block exported by a translated rom
+typedef struct {
+  unsigned short start; //address of the first instruction
+  unsigned short end; //first address after the last instruction
+  Chip8AotFunction function; //translated code of the block
+} Chip8AotBlock;
+
+#define AOT_CACHE_DIR "aot_cache" //where translated roms are kept, overridden by CHIP8_AOT_CACHE
+#define AOT_PATH_SIZE 512
+#define AOT_VERSION 2 //bumped whenever the generated code changes, invalidating the cache
+
+//translated rom loaded by the emulator
+typedef struct {
+  void *handle; //loaded shared object
+  const unsigned char *rom; //rom bytes the blocks were translated from
+  Chip8AotFunction blocks[RAM_SIZE]; //translated block starting at each address, NULL to interpret
+  unsigned short block_end[RAM_SIZE]; //first address after each translated block
+  unsigned long long code_pages; //bitmap of the ram pages holding translated code
+} Chip8Aot;
+
+//emulator side, not used by translated roms
+unsigned long long Chip8_aotHash(unsigned char *data, int size);
+unsigned long long Chip8_aotAbi(void);
+void Chip8_aotTranslate(FILE *out, unsigned char *ram, int rom_size);
+void Chip8_aotPath(unsigned char *ram, int rom_size, char *path, char *extension);
+int Chip8_aotCompile(char *c_path, char *so_path);
+int Chip8_aotBuild(unsigned char *ram, int rom_size);
+int Chip8_aotLoad(Chip8Aot *aot, unsigned char *ram, int rom_size);
+void Chip8_aotInvalidate(Chip8 *chip8, Chip8Aot *aot);
+void Chip8_aotEndBlock(Chip8 *chip8, int cycles);
+void Chip8_aotMainLoop(Chip8 *chip8, Chip8Aot *aot);
+
+#endif
@@ -0,0 +1,461 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "chip8.h"
+
+//live instrumentation of the executor
+//the emulator thread records into histograms and counters with relaxed atomic adds, so an
+//exporter thread can read them at any time without locks. readers may see a histogram
+//count one value ahead of its buckets, which only matters to the exported quantiles
+
+#define FRAME_NS ((unsigned long long) (TIMER_DELAY * 1000000000))
+
+typedef struct {
+  Chip8Metrics *metrics;
+  int format;
+  int fd; //listening socket, -1 when exporting to a file
+  int http; //if 1, exports are answered as http responses
+  char path[256]; //file rewritten on SIGUSR1, or unix socket path
+  char *export; //buffer of METRICS_EXPORT_SIZE every export is written to
+  int stop; //set by Chip8_metricsStop
+} Chip8MetricsExporter;
+
+volatile sig_atomic_t metrics_requested = 0; //set by SIGUSR1 for file exporters
+
+//monotonic host time in ns
+unsigned long long Chip8_metricsNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//clears all metrics and starts recording
+//input: metrics struct
+void Chip8_metricsInit(Chip8Metrics *metrics) {
+  memset(metrics, 0, sizeof(Chip8Metrics));
+  metrics->start = Chip8_metricsNow();
+}
+
+//finds the bucket of a value: exact below METRICS_SUB_BUCKETS, then log-linear
+int Chip8_histogramIndex(unsigned long long value) {
+  int exponent;
+
+  if (value >= 1ULL << METRICS_MAX_BITS)
+    value = (1ULL << METRICS_MAX_BITS) - 1;
+  if (value < METRICS_SUB_BUCKETS)
+    return value;
+  exponent = 63 - __builtin_clzll(value);
+  return (exponent - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS +
+         ((value >> (exponent - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+//first value above a bucket
+unsigned long long Chip8_histogramBucketEnd(int index) {
+  int shift;
+
+  if (index < METRICS_SUB_BUCKETS)
+    return index + 1;
+  shift = index / METRICS_SUB_BUCKETS - 1;
+  return (unsigned long long) (METRICS_SUB_BUCKETS + index % METRICS_SUB_BUCKETS + 1) << shift;
+}
+
+//records a value, safe to call while other threads read the histogram
+void Chip8_histogramRecord(Chip8Histogram *histogram, unsigned long long value) {
+  unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&histogram->counts[Chip8_histogramIndex(value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+  while (value > max &&
+         !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+//estimates the value below which a fraction of the recorded values are
+//output: last value of the bucket holding the quantile, never above the largest value recorded
+unsigned long long Chip8_histogramQuantile(Chip8Histogram *histogram, double quantile) {
+  unsigned long long count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+  unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  unsigned long long target = quantile * count;
+  unsigned long long seen = 0;
+  unsigned long long end;
+  int i;
+
+  if (count == 0)
+    return 0;
+  if (target >= count)
+    target = count - 1;
+
+  for (i = 0; i < METRICS_BUCKETS; i++) {
+    seen += __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    if (seen > target)
+      break;
+  }
+  end = Chip8_histogramBucketEnd(i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1) - 1;
+  return end < max ? end : max;
+}
+
+//adds to a counter, safe to call while other threads read it
+void Chip8_metricsCount(unsigned long long *counter, unsigned long long n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+//counts executed instructions, timing the first one since recording started
+//inputs: metrics struct and instructions executed
+void Chip8_metricsInstructions(Chip8Metrics *metrics, int n) {
+  if (metrics->first_instruction == 0 && n > 0)
+    __atomic_store_n(&metrics->first_instruction, Chip8_metricsNow() - metrics->start, __ATOMIC_RELAXED);
+  Chip8_metricsCount(&metrics->instructions, n);
+}
+
+//records the end of a 60Hz frame: its host time, the instructions per second it ran at and
+//the frames that should have ticked during it
+//input: metrics struct
+void Chip8_metricsFrame(Chip8Metrics *metrics) {
+  unsigned long long now = Chip8_metricsNow();
+  unsigned long long instructions = __atomic_load_n(&metrics->instructions, __ATOMIC_RELAXED);
+  unsigned long long elapsed;
+
+  if (metrics->frame_start != 0) {
+    elapsed = now - metrics->frame_start;
+    Chip8_histogramRecord(&metrics->frame_time, elapsed);
+    if (elapsed > 0)
+      Chip8_histogramRecord(&metrics->ips, (instructions - metrics->frame_instructions) * 1000000000ULL / elapsed);
+    if (elapsed >= 2 * FRAME_NS)
+      Chip8_metricsCount(&metrics->dropped_frames, elapsed / FRAME_NS - 1);
+  }
+  Chip8_metricsCount(&metrics->frames, 1);
+  metrics->frame_start = now;
+  metrics->frame_instructions = instructions;
+}
+
+//records a key event, timed until the next presented frame
+//input: metrics struct
+void Chip8_metricsInput(Chip8Metrics *metrics) {
+  if (metrics->pending_input == 0)
+    metrics->pending_input = Chip8_metricsNow();
+}
+
+//records a presented frame
+//inputs: metrics struct and ns when presenting started
+void Chip8_metricsPresent(Chip8Metrics *metrics, unsigned long long start) {
+  unsigned long long now = Chip8_metricsNow();
+
+  Chip8_histogramRecord(&metrics->present_latency, now - start);
+  if (metrics->pending_input != 0) {
+    Chip8_histogramRecord(&metrics->input_latency, now - metrics->pending_input);
+    metrics->pending_input = 0;
+  }
+}
+
+//records how much longer than asked a sleep took
+//inputs: metrics struct, ns when the sleep started and ns asked for
+void Chip8_metricsSleep(Chip8Metrics *metrics, unsigned long long start, unsigned long long asked) {
+  unsigned long long slept = Chip8_metricsNow() - start;
+  Chip8_histogramRecord(&metrics->sleep_overshoot, slept > asked ? slept - asked : 0);
+}
+
+//appends formatted text to an export, dropping what doesn't fit
+void Chip8_metricsPrint(char *out, int size, int *length, const char *format, ...) {
+  va_list args;
+
+  if (*length >= size)
+    return;
+  va_start(args, format);
+  *length += vsnprintf(&out[*length], size - *length, format, args);
+  va_end(args);
+  if (*length > size)
+    *length = size;
+}
+
+//appends a counter
+void Chip8_metricsExportCounter(int format, char *out, int size, int *length,
+                                const char *name, const char *help, unsigned long long *counter) {
+  unsigned long long value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+  if (format == METRICS_JSON)
+    Chip8_metricsPrint(out, size, length, "  \"%s\": %llu,\n", name, value);
+  else
+    Chip8_metricsPrint(out, size, length, "# HELP chip8_%s %s\n# TYPE chip8_%s counter\nchip8_%s %llu\n",
+                       name, help, name, name, value);
+}
+
+//appends a histogram. json keeps the raw values and the non empty buckets, prometheus gets
+//a summary scaled to base units, since its histograms need fixed bucket bounds
+void Chip8_metricsExportHistogram(int format, char *out, int size, int *length, const char *name,
+                                  const char *help, double scale, Chip8Histogram *histogram) {
+  const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  const char *labels[] = {"p50", "p90", "p99", "p999"};
+  unsigned long long count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+  unsigned long long sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+  unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  unsigned long long bucket;
+  int i, first = 1;
+
+  if (format == METRICS_JSON) {
+    Chip8_metricsPrint(out, size, length, "  \"%s\": {\"count\": %llu, \"sum\": %llu, \"max\": %llu",
+                       name, count, sum, max);
+    for (i = 0; i < 4; i++)
+      Chip8_metricsPrint(out, size, length, ", \"%s\": %llu", labels[i], Chip8_histogramQuantile(histogram, quantiles[i]));
+    Chip8_metricsPrint(out, size, length, ", \"buckets\": [");
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+      bucket = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+      if (bucket == 0)
+        continue;
+      Chip8_metricsPrint(out, size, length, "%s[%llu, %llu]", first ? "" : ", ", Chip8_histogramBucketEnd(i), bucket);
+      first = 0;
+    }
+    Chip8_metricsPrint(out, size, length, "]},\n");
+    return;
+  }
+
+  Chip8_metricsPrint(out, size, length, "# HELP chip8_%s %s\n# TYPE chip8_%s summary\n", name, help, name);
+  for (i = 0; i < 4; i++)
+    Chip8_metricsPrint(out, size, length, "chip8_%s{quantile=\"%g\"} %.9g\n", name, quantiles[i],
+                       Chip8_histogramQuantile(histogram, quantiles[i]) * scale);
+  Chip8_metricsPrint(out, size, length, "chip8_%s_sum %.9g\nchip8_%s_count %llu\n", name, sum * scale, name, count);
+}
+
+//writes the metrics as Prometheus text or JSON
+//inputs: metrics struct, METRICS_* format and output buffer
+//output: length of the export
+int Chip8_metricsExport(Chip8Metrics *metrics, int format, char *out, int size) {
+  double uptime = (Chip8_metricsNow() - metrics->start) / 1e9;
+  unsigned long long first = __atomic_load_n(&metrics->first_instruction, __ATOMIC_RELAXED);
+  int json = format == METRICS_JSON;
+  int length = 0;
+
+  if (json)
+    Chip8_metricsPrint(out, size, &length, "{\n");
+  Chip8_metricsExportCounter(format, out, size, &length, "instructions_total", "Instructions executed.", &metrics->instructions);
+  Chip8_metricsExportCounter(format, out, size, &length, "frames_total", "60Hz timer ticks.", &metrics->frames);
+  Chip8_metricsExportCounter(format, out, size, &length, "dropped_frames_total",
+                             "60Hz periods that passed without a timer tick.", &metrics->dropped_frames);
+  Chip8_metricsExportHistogram(format, out, size, &length, "instructions_per_second",
+                               "Instructions per second over each 60Hz frame.", 1, &metrics->ips);
+  Chip8_metricsExportHistogram(format, out, size, &length, json ? "frame_time_ns" : "frame_time_seconds",
+                               "Host time between 60Hz timer ticks.", 1e-9, &metrics->frame_time);
+  Chip8_metricsExportHistogram(format, out, size, &length, json ? "present_latency_ns" : "present_latency_seconds",
+                               "Host time spent presenting a frame.", 1e-9, &metrics->present_latency);
+  Chip8_metricsExportHistogram(format, out, size, &length, json ? "input_latency_ns" : "input_latency_seconds",
+                               "Host time from a key event to the next presented frame.", 1e-9, &metrics->input_latency);
+  Chip8_metricsExportHistogram(format, out, size, &length, json ? "sleep_overshoot_ns" : "sleep_overshoot_seconds",
+                               "Host time slept beyond what the tick scheduler asked for.", 1e-9, &metrics->sleep_overshoot);
+  if (json)
+    Chip8_metricsPrint(out, size, &length, "  \"time_to_first_instruction_ns\": %llu,\n", first);
+  else
+    Chip8_metricsPrint(out, size, &length, "# HELP chip8_time_to_first_instruction_seconds Time from the start to the "
+                       "end of the first instruction.\n# TYPE chip8_time_to_first_instruction_seconds gauge\n"
+                       "chip8_time_to_first_instruction_seconds %.9f\n", first / 1e9);
+  if (json)
+    Chip8_metricsPrint(out, size, &length, "  \"uptime_seconds\": %.3f\n}\n", uptime);
+  else
+    Chip8_metricsPrint(out, size, &length, "# HELP chip8_uptime_seconds Time since recording started.\n"
+                       "# TYPE chip8_uptime_seconds gauge\nchip8_uptime_seconds %.3f\n", uptime);
+  return length;
+}
+
+//writes an export to a file, replacing it at once so readers never see a partial export
+//inputs: metrics struct, METRICS_* format, file path and buffer of METRICS_EXPORT_SIZE
+//output: 0 if it couldn't be written
+int Chip8_metricsWriteExport(Chip8Metrics *metrics, int format, char *path, char *export) {
+  char temp[300];
+  FILE *out;
+  int length;
+
+  length = Chip8_metricsExport(metrics, format, export, METRICS_EXPORT_SIZE);
+
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  out = fopen(temp, "w");
+  if (out == NULL)
+    return 0;
+  fwrite(export, 1, length, out);
+  fclose(out);
+  return rename(temp, path) == 0;
+}
+
+//writes an export to a file once, such as the final metrics of a run
+//inputs: metrics struct, METRICS_* format and file path
+//output: 0 if it couldn't be written
+int Chip8_metricsWriteFile(Chip8Metrics *metrics, int format, char *path) {
+  char *export = malloc(METRICS_EXPORT_SIZE);
+  int written;
+
+  if (export == NULL)
+    return 0;
+  written = Chip8_metricsWriteExport(metrics, format, path, export);
+  free(export);
+  return written;
+}
+
+//answers one connection with an export. tcp clients that send an http request, such as a
+//Prometheus scrape, get an http response
+void Chip8_metricsAnswer(Chip8MetricsExporter *exporter, int fd) {
+  struct pollfd request = {fd, POLLIN, 0};
+  char *export = exporter->export;
+  char header[128];
+  char buffer[512];
+  int length, sent, offset = 0;
+
+  length = Chip8_metricsExport(exporter->metrics, exporter->format, export, METRICS_EXPORT_SIZE);
+  if (exporter->http && poll(&request, 1, 100) > 0 && recv(fd, buffer, sizeof(buffer), 0) > 0) {
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+             exporter->format == METRICS_JSON ? "application/json" : "text/plain; version=0.0.4", length);
+    send(fd, header, strlen(header), MSG_NOSIGNAL);
+  }
+  while (offset < length && (sent = send(fd, &export[offset], length - offset, MSG_NOSIGNAL)) > 0)
+    offset += sent;
+  close(fd);
+}
+
+void Chip8_metricsRequest(int signal) {
+  metrics_requested = 1;
+}
+
+//exporter thread: answers connections, or rewrites the file when SIGUSR1 arrives
+//it wakes up at least every 100ms to see if Chip8_metricsStop asked it to end
+void *Chip8_metricsExporterThread(void *argument) {
+  Chip8MetricsExporter *exporter = argument;
+  struct pollfd listener = {exporter->fd, POLLIN, 0};
+  int fd;
+
+  while (!__atomic_load_n(&exporter->stop, __ATOMIC_ACQUIRE)) {
+    if (exporter->fd < 0) {
+      usleep(100000);
+      if (metrics_requested) {
+        metrics_requested = 0;
+        Chip8_metricsWriteExport(exporter->metrics, exporter->format, exporter->path, exporter->export);
+      }
+      continue;
+    }
+    if (poll(&listener, 1, 100) <= 0)
+      continue;
+    fd = accept(exporter->fd, NULL, NULL);
+    if (fd >= 0)
+      Chip8_metricsAnswer(exporter, fd);
+    else if (errno != EINTR)
+      break;
+  }
+  return NULL;
+}
+
+//opens the listening socket of an exporter
+//output: socket, or -1 if it failed
+int Chip8_metricsListen(char *target, int *http) {
+  int fd;
+
+  if (strncmp(target, "unix:", 5) == 0) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, target + 5, sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+      return -1;
+    *http = 0;
+  }
+  else {
+    struct sockaddr_in addr;
+    int reuse = 1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(target + 4));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+      return -1;
+    *http = 1;
+  }
+
+  if (listen(fd, 16) < 0)
+    return -1;
+  return fd;
+}
+
+//starts exporting metrics on demand from a background thread, until Chip8_metricsStop
+//target is "unix:path" or "tcp:port" to answer each connection with an export, served on
+//loopback, or a file path rewritten every time the process gets SIGUSR1
+//inputs: metrics struct, METRICS_* format and target
+//output: 0 if the exporter couldn't be started or one is already running
+int Chip8_metricsServe(Chip8Metrics *metrics, int format, char *target) {
+  Chip8MetricsExporter *exporter;
+  struct sigaction action;
+
+  if (metrics->exporter != NULL)
+    return 0;
+  exporter = calloc(1, sizeof(Chip8MetricsExporter));
+  if (exporter == NULL)
+    return 0;
+  exporter->metrics = metrics;
+  exporter->format = format;
+  exporter->fd = -1;
+  exporter->export = malloc(METRICS_EXPORT_SIZE);
+  if (exporter->export == NULL) {
+    free(exporter);
+    return 0;
+  }
+
+  if (strncmp(target, "unix:", 5) == 0 || strncmp(target, "tcp:", 4) == 0) {
+    exporter->fd = Chip8_metricsListen(target, &exporter->http);
+    if (exporter->fd < 0) {
+      printf("Couldn't export metrics on %s: %s\n", target, strerror(errno));
+      free(exporter->export);
+      free(exporter);
+      return 0;
+    }
+    if (!exporter->http)
+      strncpy(exporter->path, target + 5, sizeof(exporter->path) - 1);
+  }
+  else {
+    strncpy(exporter->path, target, sizeof(exporter->path) - 1);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = Chip8_metricsRequest;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+  }
+
+  if (pthread_create(&metrics->exporter_thread, NULL, Chip8_metricsExporterThread, exporter) != 0) {
+    if (exporter->fd >= 0)
+      close(exporter->fd);
+    free(exporter->export);
+    free(exporter);
+    return 0;
+  }
+  metrics->exporter = exporter;
+  return 1;
+}
+
+//stops the exporter started by Chip8_metricsServe: waits for its thread to end, then closes
+//its socket, removing a unix socket path
+//input: metrics struct, with or without a running exporter
+void Chip8_metricsStop(Chip8Metrics *metrics) {
+  Chip8MetricsExporter *exporter = metrics->exporter;
+
+  if (exporter == NULL)
+    return;
+  __atomic_store_n(&exporter->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(metrics->exporter_thread, NULL);
+  if (exporter->fd >= 0) {
+    close(exporter->fd);
+    if (!exporter->http)
+      unlink(exporter->path);
+  }
+  free(exporter->export);
+  free(exporter);
+  metrics->exporter = NULL;
+}
@@ -0,0 +1,57 @@
+#ifndef CHIP8_METRICS_H
+#define CHIP8_METRICS_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+//histograms keep 16 linear sub buckets per power of 2, so recorded values are off by 6% at most
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS 40 //values are clamped below 2^40, 18 minutes in ns
+#define METRICS_BUCKETS ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+#define METRICS_PROMETHEUS 0 //Prometheus text exposition format
+#define METRICS_JSON 1
+#define METRICS_EXPORT_SIZE 65536 //largest export, in bytes
+
+//lock-free histogram: the emulator records with atomic adds while an exporter thread reads
+typedef struct {
+  unsigned long long counts[METRICS_BUCKETS];
+  unsigned long long count; //values recorded
+  unsigned long long sum; //sum of the values recorded
+  unsigned long long max; //largest value recorded
+} Chip8Histogram;
+
+typedef struct {
+  Chip8Histogram ips; //instructions per second, measured over each 60Hz frame
+  Chip8Histogram frame_time; //host ns between 60Hz timer ticks
+  Chip8Histogram present_latency; //host ns spent presenting a frame in Chip8_drawDisplay
+  Chip8Histogram input_latency; //host ns from a key event to the next presented frame
+  Chip8Histogram sleep_overshoot; //host ns slept beyond what the tick scheduler asked for
+  unsigned long long instructions; //instructions executed
+  unsigned long long frames; //60Hz timer ticks
+  unsigned long long dropped_frames; //60Hz periods that passed without a timer tick
+  unsigned long long start; //ns when recording started
+  unsigned long long first_instruction; //ns from the start to the end of the first instruction, 0 before
+  unsigned long long frame_start; //ns of the last timer tick
+  unsigned long long frame_instructions; //instructions executed before the last timer tick
+  unsigned long long pending_input; //ns of the oldest key event not presented yet, 0 if none
+  void *exporter; //exporter started by Chip8_metricsServe, NULL if none is running
+  pthread_t exporter_thread; //thread of that exporter, joined by Chip8_metricsStop
+} Chip8Metrics;
+
+unsigned long long Chip8_metricsNow(void);
+void Chip8_metricsInit(Chip8Metrics *metrics);
+void Chip8_histogramRecord(Chip8Histogram *histogram, unsigned long long value);
+unsigned long long Chip8_histogramQuantile(Chip8Histogram *histogram, double quantile);
+void Chip8_metricsCount(unsigned long long *counter, unsigned long long n);
+void Chip8_metricsInstructions(Chip8Metrics *metrics, int n);
+void Chip8_metricsFrame(Chip8Metrics *metrics);
+void Chip8_metricsInput(Chip8Metrics *metrics);
+void Chip8_metricsPresent(Chip8Metrics *metrics, unsigned long long start);
+void Chip8_metricsSleep(Chip8Metrics *metrics, unsigned long long start, unsigned long long asked);
+int Chip8_metricsExport(Chip8Metrics *metrics, int format, char *out, int size);
+int Chip8_metricsWriteFile(Chip8Metrics *metrics, int format, char *path);
+int Chip8_metricsServe(Chip8Metrics *metrics, int format, char *target);
+void Chip8_metricsStop(Chip8Metrics *metrics);
+
+#endif
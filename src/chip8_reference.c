@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include "chip8_reference.h"
+
+//reference interpreter used by differential testing
+//it is written to be obviously correct rather than fast: one switch, no shared code with
+//the main interpreter, every flag written after the result. it only runs headless machines
+
+//executes the instruction pointed by PC
+//input: chip8 struct
+void Reference_step(Chip8 *c) {
+  unsigned short pc = c->PC & RAM_MASK;
+  unsigned short opcode = (c->ram[pc] << 8) | c->ram[(pc + 1) & RAM_MASK];
+  unsigned char x = (opcode >> 8) & 0xF;
+  unsigned char y = (opcode >> 4) & 0xF;
+  unsigned char n = opcode & 0xF;
+  unsigned char nn = opcode & 0xFF;
+  unsigned short nnn = opcode & 0xFFF;
+  unsigned char flag;
+  int i, row, col;
+
+  c->opcode = opcode;
+  c->PC = pc + 2;
+
+  switch (opcode >> 12) {
+    case 0x0:
+      if (opcode == 0x00E0) {
+        for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+          c->display[i] = 0;
+      }
+      else if (opcode == 0x00EE) {
+        if (c->SP == 0) {
+          c->fault = FAULT_STACK_UNDERFLOW;
+          c->PC = pc;
+        }
+        else {
+          c->SP--;
+          c->PC = c->subroutine_stack[c->SP];
+        }
+      }
+      break;
+
+    case 0x1: c->PC = nnn; break;
+
+    case 0x2:
+      if (c->SP == STACK_SIZE) {
+        c->fault = FAULT_STACK_OVERFLOW;
+        c->PC = pc;
+      }
+      else {
+        c->subroutine_stack[c->SP] = c->PC;
+        c->SP++;
+        c->PC = nnn;
+      }
+      break;
+
+    case 0x3: if (c->V[x] == nn) c->PC += 2; break;
+    case 0x4: if (c->V[x] != nn) c->PC += 2; break;
+    case 0x5: if (c->V[x] == c->V[y]) c->PC += 2; break;
+    case 0x6: c->V[x] = nn; break;
+    case 0x7: c->V[x] += nn; break;
+
+    case 0x8:
+      switch (n) {
+        case 0x0: c->V[x] = c->V[y]; break;
+        case 0x1: c->V[x] |= c->V[y]; break;
+        case 0x2: c->V[x] &= c->V[y]; break;
+        case 0x3: c->V[x] ^= c->V[y]; break;
+        case 0x4:
+          flag = c->V[x] + c->V[y] > 0xFF;
+          c->V[x] += c->V[y];
+          c->V[0xF] = flag;
+          break;
+        case 0x5:
+          flag = c->V[x] >= c->V[y];
+          c->V[x] -= c->V[y];
+          c->V[0xF] = flag;
+          break;
+        case 0x6:
+          if (!SHIFT_INSTRUCTION)
+            c->V[x] = c->V[y];
+          flag = c->V[x] & 1;
+          c->V[x] >>= 1;
+          c->V[0xF] = flag;
+          break;
+        case 0x7:
+          flag = c->V[y] >= c->V[x];
+          c->V[x] = c->V[y] - c->V[x];
+          c->V[0xF] = flag;
+          break;
+        case 0xE:
+          if (!SHIFT_INSTRUCTION)
+            c->V[x] = c->V[y];
+          flag = c->V[x] >> 7;
+          c->V[x] <<= 1;
+          c->V[0xF] = flag;
+          break;
+      }
+      break;
+
+    case 0x9: if (c->V[x] != c->V[y]) c->PC += 2; break;
+    case 0xA: c->I = nnn; break;
+    case 0xB: c->PC = JUMP_INSTRUCTION ? nnn + c->V[0] : nn + c->V[x]; break;
+    case 0xC: c->V[x] = rand() & nn; break;
+
+    case 0xD:
+      flag = 0;
+      for (row = 0; row < n; row++) {
+        unsigned char sprite = c->ram[(c->I + row) & RAM_MASK];
+        unsigned char py = (c->V[y] % SCREEN_HEIGHT) + row;
+        if (py >= SCREEN_HEIGHT)
+          break;
+        for (col = 0; col < 8; col++) {
+          unsigned char px = (c->V[x] % SCREEN_WIDTH) + col;
+          if (px >= SCREEN_WIDTH)
+            break;
+          if (sprite & (0x80 >> col)) {
+            if (c->display[py * SCREEN_WIDTH + px])
+              flag = 1;
+            c->display[py * SCREEN_WIDTH + px] ^= 0xFF;
+          }
+        }
+      }
+      c->V[0xF] = flag;
+      break;
+
+    case 0xE:
+      if (nn == 0x9E && c->V[x] == c->key) c->PC += 2;
+      if (nn == 0xA1 && c->V[x] != c->key) c->PC += 2;
+      break;
+
+    case 0xF:
+      switch (nn) {
+        case 0x07: c->V[x] = c->delay_timer; break;
+        case 0x0A:
+          if (c->key < 16)
+            c->V[x] = c->key;
+          else
+            c->PC = pc;
+          break;
+        case 0x15: c->delay_timer = c->V[x]; break;
+        case 0x18: c->sound_timer = c->V[x]; break;
+        case 0x1E:
+          flag = c->I + c->V[x] > 0xFFF;
+          c->I = (c->I + c->V[x]) & RAM_MASK;
+          c->V[0xF] = flag;
+          break;
+        case 0x29: c->I = (c->V[x] & 0xF) * 5; break;
+        case 0x33:
+          c->ram[c->I & RAM_MASK] = c->V[x] / 100;
+          c->ram[(c->I + 1) & RAM_MASK] = (c->V[x] / 10) % 10;
+          c->ram[(c->I + 2) & RAM_MASK] = c->V[x] % 10;
+          break;
+        case 0x55:
+          for (i = 0; i <= x; i++)
+            c->ram[(c->I + i) & RAM_MASK] = c->V[i];
+          if (!STORE_INSTRUCTION)
+            c->I += x + 1;
+          break;
+        case 0x65:
+          for (i = 0; i <= x; i++)
+            c->V[i] = c->ram[(c->I + i) & RAM_MASK];
+          if (!STORE_INSTRUCTION)
+            c->I += x + 1;
+          break;
+      }
+      break;
+  }
+}
+
+//60Hz timer tick of the reference interpreter
+//input: chip8 struct
+void Reference_timerTick(Chip8 *c) {
+  if (c->delay_timer > 0)
+    c->delay_timer--;
+  if (c->sound_timer > 0)
+    c->sound_timer--;
+}
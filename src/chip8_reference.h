@@ -0,0 +1,9 @@
+#ifndef CHIP8_REFERENCE_H
+#define CHIP8_REFERENCE_H
+
+#include "chip8.h"
+
+void Reference_step(Chip8 *c);
+void Reference_timerTick(Chip8 *c);
+
+#endif
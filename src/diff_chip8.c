@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "chip8_reference.h"
+
+//differential testing: runs the interpreter and the reference interpreter in lockstep on
+//headless machines, compares their full state every N instructions and reports the first
+//instruction where they diverge, with the instructions that led to it
+//usage: diff_chip8 [-every N] [-cycles C] rom.ch8...
+
+#define DIFF_EVERY 64 //instructions between state comparisons
+#define DIFF_CYCLES 100000 //instructions run on each rom
+#define TRACE_WINDOW 16 //instructions printed before a divergence
+#define DIFF_KEY_FRAMES 4 //frames each key of the pseudo random key sequence is held
+
+typedef struct {
+  unsigned short PC; //address of the instruction
+  unsigned short opcode; //instruction executed
+} TraceEntry;
+
+//finds the key pressed during a frame, a hash of the frame number so replays see the same
+//keys. no key is pressed about half of the time, so EX9E, EXA1 and FX0A take both paths
+//output: key, 16 if none
+unsigned char diff_key(int frame) {
+  unsigned int hash = (frame / DIFF_KEY_FRAMES + 1) * 2654435761u;
+
+  hash ^= hash >> 16;
+  return (hash & 0x10) ? 16 : hash & 0x0F;
+}
+
+//runs one instruction on both machines with the same random numbers, keys and timer ticks
+void diff_step(Chip8 *fast, Chip8 *reference, int cycle) {
+  //CXNN on both machines gets the same random number
+  int random = (fast->ram[fast->PC & RAM_MASK] & 0xF0) == 0xC0;
+
+  if (cycle % CYCLES_PER_FRAME == 0) {
+    fast->key = diff_key(cycle / CYCLES_PER_FRAME);
+    reference->key = fast->key;
+  }
+
+  if (random)
+    srand(cycle);
+  Chip8_step(fast);
+  if (random)
+    srand(cycle);
+  Reference_step(reference);
+
+  if ((cycle + 1) % CYCLES_PER_FRAME == 0) {
+    Chip8_timerTick(fast);
+    Reference_timerTick(reference);
+  }
+}
+
+//compares the architectural state of both machines
+//output: name of the first part that differs, NULL if they are equal
+char *diff_compare(Chip8 *fast, Chip8 *reference) {
+  if (fast->PC != reference->PC) return "PC";
+  if (fast->I != reference->I) return "I";
+  if (memcmp(fast->V, reference->V, sizeof(fast->V)) != 0) return "V";
+  if (fast->SP != reference->SP) return "SP";
+  if (memcmp(fast->subroutine_stack, reference->subroutine_stack, sizeof(fast->subroutine_stack)) != 0) return "stack";
+  if (fast->delay_timer != reference->delay_timer) return "delay timer";
+  if (fast->sound_timer != reference->sound_timer) return "sound timer";
+  if (fast->fault != reference->fault) return "fault";
+  if (memcmp(fast->ram, reference->ram, RAM_SIZE) != 0) return "ram";
+  if (memcmp(fast->display, reference->display, sizeof(fast->display)) != 0) return "display";
+  return NULL;
+}
+
+//prints the registers of a machine
+void diff_printState(char *name, Chip8 *chip8) {
+  int i;
+
+  printf("  %-9s PC=%03X I=%03X SP=%X DT=%02X ST=%02X V=", name, chip8->PC, chip8->I,
+         chip8->SP, chip8->delay_timer, chip8->sound_timer);
+  for (i = 0; i < 16; i++)
+    printf("%02X%s", chip8->V[i], i < 15 ? " " : "\n");
+}
+
+//replays the last comparison window one instruction at a time to find the first divergence
+//inputs: both machines as they were at the last equal comparison, and the cycle they were at
+void diff_report(char *game, Chip8 *fast, Chip8 *reference, int cycle) {
+  TraceEntry trace[TRACE_WINDOW];
+  int count = 0;
+  int i;
+  char *part;
+
+  while (1) {
+    unsigned short pc = fast->PC & RAM_MASK;
+    trace[count % TRACE_WINDOW].PC = pc;
+    trace[count % TRACE_WINDOW].opcode = (fast->ram[pc] << 8) | fast->ram[(pc + 1) & RAM_MASK];
+    count++;
+
+    diff_step(fast, reference, cycle);
+    part = diff_compare(fast, reference);
+    if (part != NULL)
+      break;
+    cycle++;
+  }
+
+  printf("%s: diverged at instruction %d, %s differs\n", game, cycle, part);
+  i = count > TRACE_WINDOW ? count - TRACE_WINDOW : 0;
+  for (; i < count; i++) {
+    TraceEntry *entry = &trace[i % TRACE_WINDOW];
+    printf("  %s %03X  %04X  %s\n", i == count - 1 ? ">" : " ", entry->PC, entry->opcode,
+           Chip8_opcodeNames[Chip8_decode(entry->opcode)]);
+  }
+  diff_printState("fast", fast);
+  diff_printState("reference", reference);
+}
+
+//runs a game on both interpreters
+//output: 1 if they diverged
+int diff_game(char *game, int every, int cycles) {
+  Chip8 fast, reference;
+  Chip8 fast_checked, reference_checked;
+  int cycle = 0;
+  int i;
+
+  Chip8_initHeadless(&fast);
+  if (Chip8_loadGame(&fast, game) == 0)
+    return 0;
+  reference = fast;
+
+  while (cycle < cycles && fast.fault == FAULT_NONE) {
+    fast_checked = fast;
+    reference_checked = reference;
+
+    for (i = 0; i < every && fast.fault == FAULT_NONE; i++)
+      diff_step(&fast, &reference, cycle + i);
+
+    if (diff_compare(&fast, &reference) != NULL) {
+      diff_report(game, &fast_checked, &reference_checked, cycle);
+      return 1;
+    }
+    cycle += i;
+  }
+
+  printf("%s: %d instructions match%s%s\n", game, cycle,
+         fast.fault != FAULT_NONE ? ", stopped by " : "", fast.fault != FAULT_NONE ? Chip8_faultNames[fast.fault] : "");
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int every = DIFF_EVERY;
+  int cycles = DIFF_CYCLES;
+  int diverged = 0;
+  int i;
+
+  if (argc < 2) {
+    printf("usage: %s [-every N] [-cycles C] rom.ch8...\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-every") == 0 && i + 1 < argc)
+      every = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-cycles") == 0 && i + 1 < argc)
+      cycles = atoi(argv[++i]);
+    else
+      diverged += diff_game(argv[i], every < 1 ? 1 : every, cycles);
+  }
+  return diverged > 0;
+}
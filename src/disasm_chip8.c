@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include "chip8_analysis.h"
+
+#define MODE_LISTING 0 //full disassembly with basic blocks and edges
+#define MODE_SUMMARY 1 //one line of statistics per rom
+#define MODE_DOT 2 //control flow graph in graphviz format
+
+//prints the instruction at addr with its decoded name
+void disasm_printInstruction(unsigned char *ram, unsigned short addr) {
+  unsigned short opcode = Chip8_opcodeAt(ram, addr);
+  printf("  %#05X  %04X  %s\n", addr, opcode, Chip8_opcodeNames[Chip8_decode(opcode)]);
+}
+
+//prints the successors of the block that ends with the instruction at last
+void disasm_printEdges(unsigned char *ram, unsigned short last) {
+  unsigned short succ[MAX_SUCCESSORS];
+  unsigned short opcode = Chip8_opcodeAt(ram, last);
+  int i, n;
+
+  n = Chip8_successors(last, opcode, succ);
+  printf("  ->");
+  if (n == 0)
+    printf(" %s", Chip8_decode(opcode) == OP_00EE ? "return" : "stop");
+  if (Chip8_decode(opcode) == OP_BNNN)
+    printf(" indirect");
+  for (i = 0; i < n; i++)
+    printf(" %#05X", succ[i]);
+  printf("\n");
+}
+
+//prints every byte that isn't reachable code, grouped in lines of 8 bytes
+void disasm_printData(Chip8Analysis *analysis, unsigned char *ram) {
+  int addr, count = 0;
+
+  printf("data:\n");
+  for (addr = RAM_PROGRAM_START; addr < analysis->rom_end; addr++) {
+    if (analysis->flags[addr] & (ANALYSIS_CODE | ANALYSIS_OPERAND)) {
+      if (count > 0)
+        printf("\n");
+      count = 0;
+      continue;
+    }
+    if (count == 0)
+      printf("  %#05X  .byte", addr);
+    printf(" %02X%s", ram[addr], analysis->flags[addr] & ANALYSIS_DATA ? "*" : "");
+    count++;
+    if (count == 8) {
+      printf("\n");
+      count = 0;
+    }
+  }
+  if (count > 0)
+    printf("\n");
+}
+
+//prints the disassembly of every basic block
+void disasm_printListing(Chip8Analysis *analysis, unsigned char *ram) {
+  unsigned short addr, end, i;
+
+  for (addr = RAM_PROGRAM_START; addr < analysis->rom_end; addr++) {
+    unsigned char flags = analysis->flags[addr];
+    if (!(flags & ANALYSIS_CODE) || !(flags & ANALYSIS_LEADER))
+      continue;
+
+    if (flags & ANALYSIS_SUBROUTINE)
+      printf("sub_%03X:\n", addr);
+    printf("block_%03X:%s\n", addr, flags & ANALYSIS_INDIRECT ? " ; BNNN base" : "");
+
+    end = Chip8_blockEnd(analysis, ram, addr);
+    for (i = addr; i < end; i += 2)
+      disasm_printInstruction(ram, i);
+    disasm_printEdges(ram, end - 2);
+  }
+  disasm_printData(analysis, ram);
+}
+
+//prints the control flow graph in graphviz dot format
+void disasm_printDot(Chip8Analysis *analysis, unsigned char *ram, char *name) {
+  unsigned short succ[MAX_SUCCESSORS];
+  unsigned short addr, end;
+  int i, n;
+
+  printf("digraph \"%s\" {\n", name);
+  for (addr = RAM_PROGRAM_START; addr < analysis->rom_end; addr++) {
+    unsigned char flags = analysis->flags[addr];
+    if (!(flags & ANALYSIS_CODE) || !(flags & ANALYSIS_LEADER))
+      continue;
+
+    end = Chip8_blockEnd(analysis, ram, addr);
+    printf("  b%03X [label=\"%03X-%03X\"%s];\n", addr, addr, end - 2,
+           flags & ANALYSIS_SUBROUTINE ? ", shape=box" : "");
+
+    n = Chip8_successors(end - 2, Chip8_opcodeAt(ram, end - 2), succ);
+    for (i = 0; i < n; i++)
+      if (Chip8_inRom(analysis, succ[i]) && (analysis->flags[succ[i]] & ANALYSIS_CODE))
+        printf("  b%03X -> b%03X;\n", addr, succ[i]);
+  }
+  printf("}\n");
+}
+
+int main(int argc, char *argv[]) {
+  Chip8 chip8;
+  Chip8Analysis analysis;
+  int mode = MODE_LISTING;
+  int i, size;
+
+  if (argc < 2) {
+    printf("usage: %s [-s | -dot] rom.ch8...\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0) {
+      mode = MODE_SUMMARY;
+      continue;
+    }
+    if (strcmp(argv[i], "-dot") == 0) {
+      mode = MODE_DOT;
+      continue;
+    }
+
+    memset(chip8.ram, 0, RAM_SIZE);
+    size = Chip8_loadGame(&chip8, argv[i]);
+    if (size == 0)
+      continue;
+
+    Chip8_analyse(&analysis, chip8.ram, size);
+
+    if (mode == MODE_DOT) {
+      disasm_printDot(&analysis, chip8.ram, argv[i]);
+      continue;
+    }
+
+    printf("; %s: %d bytes, %d blocks, %d subroutines, %d code bytes, %d data bytes\n",
+           argv[i], size, analysis.block_count, analysis.subroutine_count,
+           analysis.code_bytes, analysis.data_bytes);
+    if (mode == MODE_LISTING)
+      disasm_printListing(&analysis, chip8.ram);
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "chip8.h"
+
+//fuzz target: runs arbitrary bytes as a game on a headless machine
+//built with libFuzzer when FUZZ_LIBFUZZER is defined (make BUILD=libfuzzer fuzz),
+//otherwise with a standalone driver meant for the asan and ubsan builds
+//usage: fuzz_chip8 [-runs N] [-seed S] [input...]
+
+#define FUZZ_FRAMES 64 //frames run on each input
+#define FUZZ_RUNS 10000 //random games run when no input is given
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  static Chip8 chip8;
+  unsigned int seed = 2166136261u;
+  size_t i;
+  int frame;
+
+  Chip8_initHeadless(&chip8);
+  if (size > MAX_GAME_SIZE)
+    size = MAX_GAME_SIZE;
+  memcpy(&chip8.ram[RAM_PROGRAM_START], data, size);
+
+  //machines seed rand() with the time, so CXNN is reseeded from the input bytes (FNV-1a)
+  //to make every finding reproducible
+  for (i = 0; i < size; i++) {
+    seed ^= data[i];
+    seed *= 16777619u;
+  }
+  srand(seed);
+
+  for (frame = 0; frame < FUZZ_FRAMES && chip8.fault == FAULT_NONE; frame++)
+    Chip8_runFrame(&chip8);
+  return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+int main(int argc, char *argv[]) {
+  static uint8_t data[MAX_GAME_SIZE];
+  unsigned int seed = 1;
+  int runs = FUZZ_RUNS;
+  int inputs = 0;
+  int i, run, size;
+  FILE *input;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+      continue;
+    }
+
+    input = fopen(argv[i], "rb");
+    if (input == NULL) {
+      printf("Couldn't open the input file: %s\n", argv[i]);
+      continue;
+    }
+    size = fread(data, 1, MAX_GAME_SIZE, input);
+    fclose(input);
+    LLVMFuzzerTestOneInput(data, size);
+    inputs++;
+  }
+  if (inputs > 0)
+    return 0;
+
+  //random games from a xorshift generator, since the machines reseed rand()
+  for (run = 0; run < runs; run++) {
+    size = 0;
+    for (i = 0; i < MAX_GAME_SIZE; i++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      data[i] = seed;
+      if (i == 0)
+        size = seed % MAX_GAME_SIZE;
+    }
+    LLVMFuzzerTestOneInput(data, size);
+  }
+  printf("%d random games run\n", runs);
+  return 0;
+}
+#endif
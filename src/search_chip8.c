@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "chip8_analysis.h"
+
+//automated playtesting: explores every input sequence of a game on a thread pool
+//usage: search_chip8 [-threads N] [-states N] [-frames N] [-screens dir] rom.ch8...
+//
+//machines run headless one 60Hz frame at a time. the held key may change once per frame:
+//the first FX0A, EX9E or EXA1 of a frame branches the machine into 17 copies, one for each
+//key and one with no key, that finish the frame. copies whose ram, display and registers hash
+//to an already seen state are dropped, so the search covers each state once
+//reports crashes (faults, invalid instructions, PC outside the rom), stuck states (the state
+//repeats without any key being read) and the code never reached, which holds the screens
+//no input sequence can show. -screens writes every distinct display as a PBM image
+//CXNN draws from a random generator copied with each machine, so found paths replay the same
+
+#define SEARCH_STATES (1 << 20) //distinct states explored per rom at most
+#define SEARCH_FRAMES 1800 //frames explored per input sequence, 30 s of emulated time
+#define SEARCH_KEYS 17 //keys 0 to F, and no key
+#define SEARCH_STUCK_WINDOW 600 //frames without input checked for repeated states
+#define SEARCH_REPORTS 1024 //distinct crash and stuck sites reported at most
+#define SEARCH_PATH_PRINTED 64 //last inputs printed with a report
+#define SEARCH_FRAME 0 //frame ended
+#define SEARCH_POLL 1 //an instruction reads the keys before the key of the frame was chosen
+#define SEARCH_CRASH 2
+
+typedef struct {
+  Chip8 chip8;
+  unsigned int seed; //random generator state used by CXNN
+  int frame; //frames run since reset
+  int cycle; //instructions run in the current frame
+  int input; //last input chosen in the input log, -1 before the first
+  unsigned char truncated; //1 if inputs leading here were dropped because the log was full
+  const char *crash; //what stopped the machine, set when a frame returns SEARCH_CRASH
+  unsigned short crash_pc; //address of the instruction that crashed
+} SearchState;
+
+typedef struct {
+  int parent; //previous input in the log, -1 for the first
+  unsigned short frame; //frame the key was chosen at
+  unsigned char key; //key held from then on, 16 for no key
+} SearchInput;
+
+typedef struct {
+  unsigned long long *slots; //0 marks an empty slot
+  unsigned long long mask; //slot count - 1
+  unsigned long long count; //hashes stored
+  unsigned long long limit; //hashes stored at most
+} SearchSet;
+
+//search of one rom, shared by the worker threads
+typedef struct {
+  Chip8Analysis analysis;
+  unsigned short rom_end;
+  int max_frames;
+  char *screens; //directory for display images, NULL to not write them
+  SearchSet states; //hashes of the states explored
+  SearchSet displays; //hashes of the displays seen
+  SearchSet reports; //crash and stuck sites already reported
+  SearchInput *inputs; //input log, the path of each state is followed through parents
+  int input_count;
+  unsigned char covered[RAM_SIZE]; //1 for each address executed
+  int crashes;
+  int stuck;
+  int deepest;
+
+  //work queue of the thread pool, used as a stack to keep the frontier small
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  SearchState **queue;
+  int queued;
+  int queue_size;
+  int busy; //workers exploring a state
+  pthread_mutex_t print_lock;
+} Search;
+
+//xorshift random generator for CXNN
+unsigned char search_random(unsigned int *seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  return *seed >> 24;
+}
+
+//hashes bytes 8 at a time
+unsigned long long search_hashBytes(unsigned long long hash, void *data, int size) {
+  unsigned char *bytes = data;
+  unsigned long long word;
+  int i;
+
+  for (i = 0; i + 8 <= size; i += 8) {
+    memcpy(&word, &bytes[i], 8);
+    hash = (hash ^ word) * 0x100000001B3ULL;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++)
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  return hash;
+}
+
+//hashes what decides the future of a machine: ram, display and registers. the held key
+//isn't hashed, since it is chosen again at the next key read
+unsigned long long search_hashState(Chip8 *chip8) {
+  unsigned long long hash = 0xCBF29CE484222325ULL;
+
+  hash = search_hashBytes(hash, chip8->ram, RAM_SIZE);
+  hash = search_hashBytes(hash, chip8->display, sizeof(chip8->display));
+  hash = search_hashBytes(hash, chip8->V, sizeof(chip8->V));
+  hash = search_hashBytes(hash, chip8->subroutine_stack, sizeof(chip8->subroutine_stack));
+  hash = search_hashBytes(hash, &chip8->I, sizeof(chip8->I));
+  hash = search_hashBytes(hash, &chip8->PC, sizeof(chip8->PC));
+  hash = search_hashBytes(hash, &chip8->SP, sizeof(chip8->SP));
+  hash = search_hashBytes(hash, &chip8->delay_timer, 1);
+  hash = search_hashBytes(hash, &chip8->sound_timer, 1);
+  return hash | 1; //never 0, which marks empty slots
+}
+
+//allocates a set for up to limit hashes, at most half full
+int search_setInit(SearchSet *set, unsigned long long limit) {
+  unsigned long long slots = 1;
+
+  while (slots < 2 * limit)
+    slots <<= 1;
+  set->slots = calloc(slots, sizeof(unsigned long long));
+  set->mask = slots - 1;
+  set->count = 0;
+  set->limit = limit;
+  return set->slots != NULL;
+}
+
+//adds a hash to a set shared by the workers, without locks
+//output: 1 if it was added, 0 if it was already there, -1 if the set is full
+int search_setInsert(SearchSet *set, unsigned long long hash) {
+  unsigned long long i = hash & set->mask;
+  unsigned long long empty;
+
+  //checked first so the slots never run out, workers racing past the limit only add a few
+  if (__atomic_load_n(&set->count, __ATOMIC_RELAXED) >= set->limit)
+    return -1;
+  while (1) {
+    empty = 0;
+    if (__atomic_compare_exchange_n(&set->slots[i], &empty, hash, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      break;
+    if (empty == hash)
+      return 0;
+    i = (i + 1) & set->mask;
+  }
+  if (__atomic_fetch_add(&set->count, 1, __ATOMIC_RELAXED) >= set->limit)
+    return -1;
+  return 1;
+}
+
+//adds a state to the work queue
+void search_push(Search *search, SearchState *state) {
+  pthread_mutex_lock(&search->lock);
+  if (search->queued == search->queue_size) {
+    search->queue_size = search->queue_size ? 2 * search->queue_size : 1024;
+    search->queue = realloc(search->queue, search->queue_size * sizeof(SearchState *));
+  }
+  search->queue[search->queued++] = state;
+  pthread_cond_signal(&search->ready);
+  pthread_mutex_unlock(&search->lock);
+}
+
+//takes a state from the work queue, waiting while other workers may still add some
+//output: state, or NULL once the search is over
+SearchState *search_pop(Search *search) {
+  SearchState *state = NULL;
+
+  pthread_mutex_lock(&search->lock);
+  search->busy--;
+  while (search->queued == 0 && search->busy > 0)
+    pthread_cond_wait(&search->ready, &search->lock);
+  if (search->queued > 0) {
+    state = search->queue[--search->queued];
+    search->busy++;
+  }
+  else {
+    pthread_cond_broadcast(&search->ready);
+  }
+  pthread_mutex_unlock(&search->lock);
+  return state;
+}
+
+//appends the key chosen for a state to the input log
+//once the log is full the state keeps its last logged input and is marked truncated, so
+//reports on it and on the states it leads to say their path misses inputs
+//inputs: search, state, frame the key was chosen at and key
+void search_logInput(Search *search, SearchState *state, int frame, unsigned char key) {
+  int index = __atomic_fetch_add(&search->input_count, 1, __ATOMIC_RELAXED);
+
+  if (index >= SEARCH_STATES + SEARCH_REPORTS) {
+    state->truncated = 1;
+    return;
+  }
+  search->inputs[index].parent = state->input;
+  search->inputs[index].frame = frame;
+  search->inputs[index].key = key;
+  state->input = index;
+}
+
+//prints a crash or stuck state with the inputs that lead to it, once per site
+//inputs: search, state and key chosen for its current frame, -1 if it wasn't just chosen
+void search_report(Search *search, SearchState *state, int key) {
+  unsigned long long site = search_hashBytes(state->crash_pc, (void *) state->crash, strlen(state->crash));
+  int path[SEARCH_PATH_PRINTED];
+  int count = 0, total = 0;
+  int input;
+
+  if (search_setInsert(&search->reports, site | 1) != 1)
+    return;
+  if (key >= 0)
+    search_logInput(search, state, state->frame, key);
+  for (input = state->input; input >= 0; input = search->inputs[input].parent) {
+    if (count < SEARCH_PATH_PRINTED)
+      path[count++] = input;
+    total++;
+  }
+
+  pthread_mutex_lock(&search->print_lock);
+  printf("  %s at %03X, frame %d, %d inputs%s:%s", state->crash, state->crash_pc, state->frame, total,
+         state->truncated ? " (truncated, the input log was full)" : "", total > count ? " ..." : "");
+  while (count > 0) {
+    SearchInput *entry = &search->inputs[path[--count]];
+    if (entry->key < 16)
+      printf(" %d:%X", entry->frame, entry->key);
+    else
+      printf(" %d:-", entry->frame);
+  }
+  printf("\n");
+  pthread_mutex_unlock(&search->print_lock);
+}
+
+//writes a display as a PBM image named after its hash
+void search_writeScreen(Search *search, Chip8 *chip8, unsigned long long hash) {
+  char path[512];
+  FILE *out;
+  int i;
+
+  snprintf(path, sizeof(path), "%s/%016llx.pbm", search->screens, hash);
+  out = fopen(path, "w");
+  if (out == NULL)
+    return;
+  fprintf(out, "P1\n%d %d\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+  for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+    fprintf(out, "%c%s", chip8->display[i] ? '1' : '0', (i + 1) % SCREEN_WIDTH ? " " : "\n");
+  fclose(out);
+}
+
+//runs the rest of the current frame, like Chip8_runFrame
+//inputs: search, state and 1 if the key of the frame was already chosen
+//output: SEARCH_FRAME, SEARCH_POLL before an instruction that reads the keys, or SEARCH_CRASH
+int search_runFrame(Search *search, SearchState *state, int chosen) {
+  Chip8 *chip8 = &state->chip8;
+  unsigned short pc, opcode;
+  unsigned char op;
+
+  while (state->cycle < CYCLES_PER_FRAME) {
+    pc = chip8->PC & RAM_MASK;
+    opcode = Chip8_opcodeAt(chip8->ram, pc);
+    op = Chip8_decode(opcode);
+
+    if (!chosen && (op == OP_FX0A || op == OP_EX9E || op == OP_EXA1))
+      return SEARCH_POLL;
+    if (Chip8_idleLoop(chip8) != IDLE_NONE)
+      break;
+    state->crash_pc = pc;
+    if (pc < RAM_PROGRAM_START || pc >= search->rom_end) {
+      state->crash = "PC outside the rom";
+      return SEARCH_CRASH;
+    }
+    if (op == OP_INVALID) {
+      state->crash = "invalid instruction";
+      return SEARCH_CRASH;
+    }
+
+    __atomic_store_n(&search->covered[pc], 1, __ATOMIC_RELAXED);
+    if (op == OP_CXNN) {
+      chip8->opcode = opcode;
+      chip8->PC = pc + 2;
+      chip8->V[(opcode >> 8) & 0xF] = search_random(&state->seed) & opcode;
+    }
+    else {
+      Chip8_step(chip8);
+    }
+    if (chip8->fault != FAULT_NONE) {
+      state->crash = Chip8_faultNames[chip8->fault];
+      return SEARCH_CRASH;
+    }
+    state->cycle++;
+  }
+
+  Chip8_timerTick(chip8);
+  state->cycle = 0;
+  state->frame++;
+  return SEARCH_FRAME;
+}
+
+//counts a state reached at the end of a frame
+//output: 1 if it is new and must be explored
+int search_visit(Search *search, SearchState *state, unsigned long long hash) {
+  unsigned long long display;
+  int deepest;
+
+  if (search_setInsert(&search->states, hash) != 1)
+    return 0;
+
+  display = search_hashBytes(0xCBF29CE484222325ULL, state->chip8.display, sizeof(state->chip8.display)) | 1;
+  if (search_setInsert(&search->displays, display) == 1 && search->screens != NULL)
+    search_writeScreen(search, &state->chip8, display);
+
+  deepest = __atomic_load_n(&search->deepest, __ATOMIC_RELAXED);
+  while (state->frame > deepest &&
+         !__atomic_compare_exchange_n(&search->deepest, &deepest, state->frame, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return 1;
+}
+
+//runs a state frame by frame until it reads the keys, then queues a copy for each key
+//the state is consumed
+void search_explore(Search *search, SearchState *state) {
+  unsigned long long recent[SEARCH_STUCK_WINDOW];
+  unsigned long long hash;
+  int recent_count = 0;
+  int result, key, i;
+
+  while (state->frame < search->max_frames) {
+    result = search_runFrame(search, state, 0);
+    if (result == SEARCH_CRASH) {
+      search_report(search, state, -1);
+      __atomic_fetch_add(&search->crashes, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    if (result == SEARCH_POLL) {
+      for (key = 0; key < SEARCH_KEYS; key++) {
+        SearchState *next = malloc(sizeof(SearchState));
+        if (next == NULL)
+          break;
+        *next = *state;
+        next->chip8.key = key;
+        result = search_runFrame(search, next, 1);
+        if (result == SEARCH_CRASH) {
+          search_report(search, next, key);
+          __atomic_fetch_add(&search->crashes, 1, __ATOMIC_RELAXED);
+          free(next);
+        }
+        else if (search_visit(search, next, search_hashState(&next->chip8))) {
+          search_logInput(search, next, state->frame, key);
+          search_push(search, next);
+        }
+        else {
+          free(next);
+        }
+      }
+      break;
+    }
+
+    //no key was read this frame: the state follows from the previous one alone
+    hash = search_hashState(&state->chip8);
+    if (!search_visit(search, state, hash)) {
+      for (i = 0; i < recent_count; i++) {
+        if (recent[i] == hash) {
+          state->crash = "stuck";
+          state->crash_pc = state->chip8.PC & RAM_MASK;
+          search_report(search, state, -1);
+          __atomic_fetch_add(&search->stuck, 1, __ATOMIC_RELAXED);
+          break;
+        }
+      }
+      break;
+    }
+    if (recent_count < SEARCH_STUCK_WINDOW)
+      recent[recent_count++] = hash;
+  }
+  free(state);
+}
+
+void *search_worker(void *argument) {
+  Search *search = argument;
+  SearchState *state;
+
+  while ((state = search_pop(search)) != NULL)
+    search_explore(search, state);
+  return NULL;
+}
+
+//prints the basic blocks the search never executed
+void search_printUnreached(Search *search) {
+  int blocks = 0, bytes = 0, code = 0;
+  int addr;
+
+  for (addr = RAM_PROGRAM_START; addr < search->rom_end; addr++) {
+    if (!(search->analysis.flags[addr] & ANALYSIS_CODE))
+      continue;
+    code += 2;
+    if (search->covered[addr])
+      continue;
+    bytes += 2;
+    if (search->analysis.flags[addr] & ANALYSIS_LEADER) {
+      if (blocks == 0)
+        printf("  unreached blocks:");
+      if (blocks < 32)
+        printf(" %03X", addr);
+      blocks++;
+    }
+  }
+  if (blocks > 0)
+    printf("%s\n", blocks > 32 ? " ..." : "");
+  printf("  code reached: %d of %d bytes\n", code - bytes, code);
+}
+
+//explores a game with a pool of threads
+//output: number of crashes found
+int search_game(char *game, int threads, int states, int max_frames, char *screens) {
+  Search *search = calloc(1, sizeof(Search));
+  SearchState *start = malloc(sizeof(SearchState));
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  struct timespec begin, end;
+  unsigned long long explored;
+  double seconds;
+  int size, i, crashes = 0;
+
+  if (search == NULL || start == NULL || workers == NULL || !search_setInit(&search->states, states) ||
+      !search_setInit(&search->displays, states) || !search_setInit(&search->reports, SEARCH_REPORTS) ||
+      (search->inputs = malloc((SEARCH_STATES + SEARCH_REPORTS) * sizeof(SearchInput))) == NULL) {
+    printf("Not enough memory to search %s\n", game);
+    goto cleanup;
+  }
+
+  Chip8_initHeadless(&start->chip8);
+  size = Chip8_loadGame(&start->chip8, game);
+  if (size > 0) {
+    Chip8_analyse(&search->analysis, start->chip8.ram, size);
+    search->rom_end = search->analysis.rom_end;
+    search->max_frames = max_frames;
+    search->screens = screens;
+    start->seed = 0x2545F491;
+    start->frame = 0;
+    start->cycle = 0;
+    start->input = -1;
+    start->truncated = 0;
+    pthread_mutex_init(&search->lock, NULL);
+    pthread_mutex_init(&search->print_lock, NULL);
+    pthread_cond_init(&search->ready, NULL);
+
+    printf("%s:\n", game);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    search->busy = threads;
+    search_push(search, start);
+    start = NULL;
+    for (i = 0; i < threads; i++)
+      pthread_create(&workers[i], NULL, search_worker, search);
+    for (i = 0; i < threads; i++)
+      pthread_join(workers[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    //count also goes up for the inserts refused once the limit was reached
+    explored = search->states.count < search->states.limit ? search->states.count : search->states.limit;
+    search_printUnreached(search);
+    printf("  %llu states%s, %llu screens, %d frames deep, %d crashing paths, %d stuck, %.2f s, %.0f states/s\n",
+           explored, search->states.count >= search->states.limit ? " (state limit reached)" : "",
+           search->displays.count, search->deepest, search->crashes, search->stuck, seconds,
+           explored / seconds);
+    crashes = search->crashes;
+    pthread_mutex_destroy(&search->lock);
+    pthread_mutex_destroy(&search->print_lock);
+    pthread_cond_destroy(&search->ready);
+  }
+
+cleanup:
+  //the start state when it wasn't queued, and states left in the queue when the state
+  //limit was reached
+  free(start);
+  if (search != NULL) {
+    for (i = 0; i < search->queued; i++)
+      free(search->queue[i]);
+    free(search->queue);
+    free(search->states.slots);
+    free(search->displays.slots);
+    free(search->reports.slots);
+    free(search->inputs);
+    free(search);
+  }
+  free(workers);
+  return crashes;
+}
+
+int main(int argc, char *argv[]) {
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int states = SEARCH_STATES;
+  int frames = SEARCH_FRAMES;
+  char *screens = NULL;
+  int crashes = 0;
+  int i;
+
+  if (argc < 2) {
+    printf("usage: %s [-threads N] [-states N] [-frames N] [-screens dir] rom.ch8...\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-states") == 0 && i + 1 < argc)
+      states = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+      frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-screens") == 0 && i + 1 < argc)
+      screens = argv[++i];
+    else
+      crashes += search_game(argv[i], threads < 1 ? 1 : threads,
+                             states < 1 || states > SEARCH_STATES ? SEARCH_STATES : states, frames, screens);
+  }
+  return crashes > 0;
+}
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE //accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "chip8.h"
+
+//remote play server: every connection gets its own headless chip8 running the same game
+//usage: server_chip8 game.ch8 [-port N | -unix path]
+//
+//clients send key bitmaps of 2 bytes, little endian, bit n set while key n is pressed
+//the server streams a frame whenever the display changes: 2 bytes of payload length,
+//little endian, then (count, byte) run length pairs of the XOR between the new display and
+//the one last sent, packed 1 bit per pixel, 8 pixels per byte, msb first. the client starts
+//with a blank display. when the game faults, the server sends the last changes and closes
+//the connection
+
+#define SERVER_PORT 8088
+#define MAX_SESSIONS 1024
+#define MAX_EVENTS 64
+#define PACKED_DISPLAY_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT / 8)
+#define MAX_FRAME_SIZE (2 + 2 * PACKED_DISPLAY_SIZE) //header and worst case run length encoding
+#define SEND_BUFFER_SIZE (8 * MAX_FRAME_SIZE)
+#define MAX_FRAMES_BEHIND 4 //timer expirations caught up at once after the server was busy
+
+typedef struct {
+  int fd; //client socket
+  Chip8 chip8; //machine played by the client
+  unsigned char shown[PACKED_DISPLAY_SIZE]; //display as last streamed to the client
+  unsigned char out[SEND_BUFFER_SIZE]; //frames are encoded in place here and sent from here
+  int out_start; //first byte not sent yet
+  int out_end; //first free byte
+  unsigned char in[2]; //key bitmap being received
+  int in_size; //bytes of the key bitmap received so far
+} Session;
+
+Session *sessions[MAX_SESSIONS];
+int session_count = 0;
+Chip8 boot; //machine with the game loaded, copied into each new session
+
+//packs the display at 1 bit per pixel
+void server_packDisplay(Chip8 *chip8, unsigned char *packed) {
+  int i, j;
+
+  for (i = 0; i < PACKED_DISPLAY_SIZE; i++) {
+    packed[i] = 0;
+    for (j = 0; j < 8; j++)
+      packed[i] = (packed[i] << 1) | (chip8->display[i * 8 + j] & 1);
+  }
+}
+
+//encodes the changes to the display directly into the send buffer
+//frames are skipped while the client lags behind, the next one carries every change
+//output: 1 if a frame was queued, 0 if the display didn't change or there is no room
+int server_queueFrame(Session *session) {
+  unsigned char packed[PACKED_DISPLAY_SIZE];
+  unsigned char delta[PACKED_DISPLAY_SIZE];
+  unsigned char *frame;
+  int changed = 0;
+  int i, size = 0;
+
+  server_packDisplay(&session->chip8, packed);
+  for (i = 0; i < PACKED_DISPLAY_SIZE; i++) {
+    delta[i] = packed[i] ^ session->shown[i];
+    changed |= delta[i];
+  }
+  if (!changed)
+    return 0;
+
+  //moving unsent bytes to the start of the buffer to make room
+  if (SEND_BUFFER_SIZE - session->out_end < MAX_FRAME_SIZE && session->out_start > 0) {
+    memmove(session->out, &session->out[session->out_start], session->out_end - session->out_start);
+    session->out_end -= session->out_start;
+    session->out_start = 0;
+  }
+  if (SEND_BUFFER_SIZE - session->out_end < MAX_FRAME_SIZE)
+    return 0;
+
+  frame = &session->out[session->out_end];
+  for (i = 0; i < PACKED_DISPLAY_SIZE; i++) {
+    if (size > 0 && frame[2 + size - 1] == delta[i] && frame[2 + size - 2] < 255) {
+      frame[2 + size - 2]++;
+    }
+    else {
+      frame[2 + size] = 1;
+      frame[2 + size + 1] = delta[i];
+      size += 2;
+    }
+  }
+  frame[0] = size & 0xFF;
+  frame[1] = size >> 8;
+  session->out_end += 2 + size;
+
+  memcpy(session->shown, packed, PACKED_DISPLAY_SIZE);
+  return 1;
+}
+
+//sends as much of the send buffer as the socket takes without blocking
+//output: 0 if the connection failed
+int server_flush(Session *session) {
+  while (session->out_start < session->out_end) {
+    int sent = send(session->fd, &session->out[session->out_start],
+                    session->out_end - session->out_start, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    session->out_start += sent;
+  }
+  session->out_start = 0;
+  session->out_end = 0;
+  return 1;
+}
+
+//reads key bitmaps sent by the client, keeping the lowest key pressed
+//output: 0 if the connection was closed or failed
+int server_receiveKeys(Session *session) {
+  unsigned char buffer[256];
+  int i, received;
+
+  while (1) {
+    received = recv(session->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received == 0)
+      return 0;
+    if (received < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    for (i = 0; i < received; i++) {
+      session->in[session->in_size++] = buffer[i];
+      if (session->in_size < 2)
+        continue;
+      session->in_size = 0;
+
+      unsigned short keys = session->in[0] | (session->in[1] << 8);
+      session->chip8.key = 16;
+      if (keys != 0)
+        session->chip8.key = __builtin_ctz(keys);
+    }
+  }
+}
+
+//starts a session for a new client with a fresh copy of the game
+void server_accept(int epoll_fd, int listen_fd) {
+  struct epoll_event event;
+  Session *session;
+  int fd;
+
+  while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    if (session_count == MAX_SESSIONS) {
+      close(fd);
+      continue;
+    }
+    session = calloc(1, sizeof(Session));
+    if (session == NULL) {
+      close(fd);
+      continue;
+    }
+    session->fd = fd;
+    session->chip8 = boot;
+
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = session;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      close(fd);
+      free(session);
+      continue;
+    }
+    sessions[session_count++] = session;
+  }
+}
+
+//ends a session and frees it
+void server_close(int epoll_fd, Session *session) {
+  int i;
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+  close(session->fd);
+  for (i = 0; i < session_count; i++) {
+    if (sessions[i] == session) {
+      sessions[i] = sessions[--session_count];
+      break;
+    }
+  }
+  free(session);
+}
+
+//runs frames on every session and streams the display changes
+//a faulted machine never changes again, so its session ends once its last frame is sent
+void server_runFrames(int epoll_fd, int frames) {
+  int i, j;
+
+  if (frames > MAX_FRAMES_BEHIND)
+    frames = MAX_FRAMES_BEHIND;
+
+  for (i = session_count - 1; i >= 0; i--) {
+    Session *session = sessions[i];
+    for (j = 0; j < frames && session->chip8.fault == FAULT_NONE; j++)
+      Chip8_runFrame(&session->chip8);
+    if ((server_queueFrame(session) && !server_flush(session)) ||
+        (session->chip8.fault != FAULT_NONE && session->out_start == session->out_end))
+      server_close(epoll_fd, session);
+  }
+}
+
+//opens the listening socket, on loopback tcp or on a unix domain socket path
+//a stale socket left at the path is replaced, anything else there makes bind fail
+//output: socket, or -1 if it failed
+int server_listen(int port, char *unix_path) {
+  int fd;
+
+  if (unix_path != NULL) {
+    struct sockaddr_un addr;
+    struct stat info;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(unix_path) >= sizeof(addr.sun_path)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    strcpy(addr.sun_path, unix_path);
+    if (lstat(unix_path, &info) == 0 && S_ISSOCK(info.st_mode))
+      unlink(unix_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+      return -1;
+  }
+  else {
+    struct sockaddr_in addr;
+    int reuse = 1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+      return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+      return -1;
+  }
+
+  if (listen(fd, 128) < 0)
+    return -1;
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event event;
+  struct itimerspec frame_timer;
+  unsigned long long expirations;
+  char *unix_path = NULL;
+  int port = SERVER_PORT;
+  int epoll_fd, listen_fd, timer_fd;
+  int i, n, frames;
+
+  if (argc < 2) {
+    printf("usage: %s game.ch8 [-port N | -unix path]\n", argv[0]);
+    return 1;
+  }
+  for (i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-port") == 0)
+      port = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-unix") == 0)
+      unix_path = argv[i + 1];
+  }
+
+  Chip8_initHeadless(&boot);
+  if (Chip8_loadGame(&boot, argv[1]) == 0)
+    return 1;
+
+  listen_fd = server_listen(port, unix_path);
+  if (listen_fd < 0) {
+    printf("Couldn't listen for clients: %s\n", strerror(errno));
+    return 1;
+  }
+
+  //60Hz frame clock
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  memset(&frame_timer, 0, sizeof(frame_timer));
+  frame_timer.it_interval.tv_nsec = TIMER_DELAY * 1000000000;
+  frame_timer.it_value.tv_nsec = TIMER_DELAY * 1000000000;
+  if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &frame_timer, NULL) < 0) {
+    printf("Couldn't start the frame clock: %s\n", strerror(errno));
+    return 1;
+  }
+
+  epoll_fd = epoll_create1(0);
+  event.events = EPOLLIN;
+  event.data.ptr = &listen_fd;
+  if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0) {
+    printf("Couldn't wait for clients: %s\n", strerror(errno));
+    return 1;
+  }
+  event.data.ptr = &timer_fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) < 0) {
+    printf("Couldn't wait for the frame clock: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("Serving %s\n", argv[1]);
+  while (1) {
+    n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    frames = 0;
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == &listen_fd) {
+        server_accept(epoll_fd, listen_fd);
+        continue;
+      }
+      if (events[i].data.ptr == &timer_fd) {
+        if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+          frames = expirations;
+        continue;
+      }
+
+      Session *session = events[i].data.ptr;
+      if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+          ((events[i].events & EPOLLIN) && !server_receiveKeys(session)) ||
+          ((events[i].events & EPOLLOUT) && !server_flush(session)))
+        server_close(epoll_fd, session);
+    }
+
+    //frames run after the other events, since they may close sessions with pending events
+    if (frames > 0)
+      server_runFrames(epoll_fd, frames);
+  }
+  return 0;
+}
@@ -1,12 +1,48 @@
 #include <stdio.h>
-#include "chip8.c"
+#include <string.h>
+#include "chip8_aot.h"
 
 int main(int argc, char *argv[]) {
   Chip8 chip8;
+  Chip8Aot aot;
+  Chip8Metrics metrics;
+  char *game = "../rom/games/Pong (1 player).ch8";
+  //char *game = "../rom/programs/Framed MK1 [GV Samways, 1980].ch8";
+  char *metrics_target = NULL;
+  int metrics_format = METRICS_PROMETHEUS;
+  int use_aot = 0;
+  int i, size;
 
+  //usage: test_chip8 [-aot] [-metrics file | unix:path | tcp:port] [-json] [game]
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-aot") == 0)
+      use_aot = 1;
+    else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc)
+      metrics_target = argv[++i];
+    else if (strcmp(argv[i], "-json") == 0)
+      metrics_format = METRICS_JSON;
+    else
+      game = argv[i];
+  }
+
+  //recording starts first, so time to first instruction covers the whole startup
+  if (metrics_target != NULL)
+    Chip8_metricsInit(&metrics);
   Chip8_init(&chip8);
-  Chip8_loadGame(&chip8, "../rom/games/Pong (1 player).ch8");
-  //Chip8_loadGame(&chip8, "../rom/programs/Framed MK1 [GV Samways, 1980].ch8");
-  Chip8_interpreterMainLoop(&chip8);
-  return 0;
+  if (metrics_target != NULL && Chip8_metricsServe(&metrics, metrics_format, metrics_target))
+    chip8.metrics = &metrics;
+
+  size = Chip8_loadGame(&chip8, game);
+  if (use_aot && size > 0 && Chip8_aotLoad(&aot, chip8.ram, size))
+    Chip8_aotMainLoop(&chip8, &aot);
+  else
+    Chip8_interpreterMainLoop(&chip8);
+
+  //a file target also gets the final metrics
+  if (chip8.metrics != NULL) {
+    Chip8_metricsStop(&metrics);
+    if (strncmp(metrics_target, "unix:", 5) != 0 && strncmp(metrics_target, "tcp:", 4) != 0)
+      Chip8_metricsWriteFile(&metrics, metrics_format, metrics_target);
+  }
+  return chip8.fault != FAULT_NONE;
 }